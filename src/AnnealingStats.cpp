@@ -0,0 +1,94 @@
+#include "AnnealingStats.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include <fmt/format.h>
+
+using std::string;
+using std::string_view;
+
+static const char* check_names[num_move_checks] = {
+	"valid",
+	"vertex_overlap",
+	"rotation_at_vertex",
+	"rotation_at_neighbor",
+	"segment_crossing"
+};
+
+AnnealingStats::AnnealingStats(string_view name, int window) : name(name), window(window) {}
+
+void AnnealingStats::iteration() {
+	++iterations;
+	if (iterations % window == 0) {
+		long long decisions = window_accepted + window_rejected;
+		if (decisions > 0) window_accept_rates.push_back(static_cast<double>(window_accepted) / decisions);
+		else window_accept_rates.push_back(std::numeric_limits<double>::quiet_NaN());
+		window_accepted = 0;
+		window_rejected = 0;
+	}
+}
+
+string AnnealingStats::summary() const {
+	double recent = window_accept_rates.empty() ? std::nan("") : window_accept_rates.back();
+	return fmt::format("accept rate {:.3} (last window), invalid moves: overlap {}, rotation {}, neighbor rotation {}, crossing {}",
+		recent,
+		checks[static_cast<int>(MoveCheck::VertexOverlap)],
+		checks[static_cast<int>(MoveCheck::RotationAtVertex)],
+		checks[static_cast<int>(MoveCheck::RotationAtNeighbor)],
+		checks[static_cast<int>(MoveCheck::SegmentCrossing)]);
+}
+
+void AnnealingStats::write_json(std::ostream& out) const {
+	out << fmt::format("{{\n\t\t\"name\": \"{}\",\n\t\t\"iterations\": {},\n\t\t\"checks\": {{", name, iterations);
+	for (int i = 0; i < num_move_checks; ++i) {
+		out << fmt::format("{}\"{}\": {}", i == 0 ? "" : ", ", check_names[i], checks[i]);
+	}
+	out << fmt::format("}},\n\t\t\"accepted\": {},\n\t\t\"rejected\": {},\n\t\t\"forced\": {},\n\t\t\"window\": {},\n\t\t\"window_accept_rates\": [",
+		accepted, rejected, forced, window);
+	for (size_t i = 0; i < window_accept_rates.size(); ++i) {
+		if (i > 0) out << ", ";
+		double rate = window_accept_rates[i];
+		if (std::isnan(rate)) out << "null";
+		else out << fmt::format("{:.4}", rate);
+	}
+	out << "]\n\t}";
+}
+
+template<typename T>
+static void write_raw(std::ostream& out, const T& x) {
+	out.write(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+template<typename T>
+static bool read_raw(std::istream& in, T& x) {
+	return static_cast<bool>(in.read(reinterpret_cast<char*>(&x), sizeof(T)));
+}
+
+void AnnealingStats::write_binary(std::ostream& out) const {
+	write_raw(out, iterations);
+	for (long long count : checks) write_raw(out, count);
+	write_raw(out, accepted);
+	write_raw(out, rejected);
+	write_raw(out, forced);
+	write_raw(out, window_accepted);
+	write_raw(out, window_rejected);
+	write_raw(out, static_cast<uint64_t>(window_accept_rates.size()));
+	for (double rate : window_accept_rates) write_raw(out, rate);
+}
+
+bool AnnealingStats::read_binary(std::istream& in) {
+	bool ok = read_raw(in, iterations);
+	for (long long& count : checks) ok = ok && read_raw(in, count);
+	uint64_t num_rates = 0;
+	ok = ok && read_raw(in, accepted) && read_raw(in, rejected) && read_raw(in, forced)
+		&& read_raw(in, window_accepted) && read_raw(in, window_rejected) && read_raw(in, num_rates);
+	if (!ok) return false;
+	window_accept_rates.clear();
+	for (uint64_t i = 0; i < num_rates; ++i) {
+		double rate;
+		if (!read_raw(in, rate)) return false;
+		window_accept_rates.push_back(rate);
+	}
+	return true;
+}
@@ -0,0 +1,48 @@
+#ifndef INCLUDED_ANNEALING_STATS
+#define INCLUDED_ANNEALING_STATS
+
+#include <string>
+#include <string_view>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "geometry_help.h"
+
+// Counts why annealing moves fail and how often the Metropolis criterion accepts.
+class AnnealingStats {
+public:
+	AnnealingStats(std::string_view name, int window = 1000);
+
+	std::string name;
+	int window;
+
+	long long iterations = 0;
+	long long checks[num_move_checks] = {};
+	long long accepted = 0;
+	long long rejected = 0;
+	long long forced = 0;
+
+	// Metropolis accept rate of every completed window of iterations; NaN if no decisions.
+	std::vector<double> window_accept_rates;
+
+	void iteration();
+	void record(MoveCheck result) { ++checks[static_cast<int>(result)]; }
+	void record_forced() { ++forced; }
+	void record_decision(bool accept) {
+		if (accept) { ++accepted; ++window_accepted; }
+		else { ++rejected; ++window_rejected; }
+	}
+
+	std::string summary() const;
+	void write_json(std::ostream& out) const;
+	// Counters in binary, for snapshots; the name and window are not included.
+	void write_binary(std::ostream& out) const;
+	bool read_binary(std::istream& in);
+
+private:
+	long long window_accepted = 0;
+	long long window_rejected = 0;
+};
+
+#endif //ndef INCLUDED_ANNEALING_STATS
@@ -21,9 +21,8 @@ using Segment = Kernel::Segment_2;
 using std::vector;
 
 static const int W = 512;
-std::vector<Edge*> buffer[W * W];
 
-bool BinnedGeometry::check_intersections(const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
+void BinnedGeometry::fill_bins(const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
 	minX = numeric_limits<double>::max();
 	minY = numeric_limits<double>::max();
 	maxX = numeric_limits<double>::lowest();
@@ -34,7 +33,8 @@ bool BinnedGeometry::check_intersections(const vector<Vertex*>& vertices, const
 		minY = std::min(minY, v->current.y);
 		maxY = std::max(maxY, v->current.y);
 	}
-	// clear buffer
+	// clear buffer; allocated on first use and kept for later checks with this instance
+	if (buffer.empty()) buffer.resize(W * W);
 	for (int i = 0; i < W * W; ++i) {
 		buffer[i].clear();
 	}
@@ -42,6 +42,10 @@ bool BinnedGeometry::check_intersections(const vector<Vertex*>& vertices, const
 	for (Edge* e : edges) {
 		draw_edge(e);
 	}
+}
+
+bool BinnedGeometry::check_intersections(const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
+	fill_bins(vertices, edges);
 
 	// handle bins
 	for (int i = 0; i < W * W; ++i) {
@@ -50,6 +54,42 @@ bool BinnedGeometry::check_intersections(const vector<Vertex*>& vertices, const
 	return true;
 }
 
+vector<Vertex*> BinnedGeometry::collect_violations(const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
+	vector<char> involved(vertices.size(), 0);
+	// overlapping vertices
+	for (Vertex* v : overlapping_vertices(vertices)) involved[v->id] = 1;
+	// broken rotation systems
+	for (Vertex* v : vertices) {
+		if (v->rotsys_valid()) continue;
+		involved[v->id] = 1;
+		for (Edge* e : v->N) involved[e->other(v)->id] = 1;
+	}
+	// crossings
+	fill_bins(vertices, edges);
+	for (int i = 0; i < W * W; ++i) {
+		const vector<Edge*>& bin = buffer[i];
+		int n = bin.size();
+		for (int j = 0; j < n - 1; ++j) {
+			Edge* e = bin[j];
+			Segment seg = Segment(Point(e->a->current.x, e->a->current.y), Point(e->b->current.x, e->b->current.y));
+			for (int k = j + 1; k < n; ++k) {
+				Edge* e2 = bin[k];
+				if (e->a == e2->a || e->a == e2->b || e->b == e2->a || e->b == e2->b) continue;
+				Segment seg2 = Segment(Point(e2->a->current.x, e2->a->current.y), Point(e2->b->current.x, e2->b->current.y));
+				if (intersection(seg, seg2)) {
+					involved[e->a->id] = involved[e->b->id] = 1;
+					involved[e2->a->id] = involved[e2->b->id] = 1;
+				}
+			}
+		}
+	}
+	vector<Vertex*> result;
+	for (Vertex* v : vertices) {
+		if (involved[v->id]) result.push_back(v);
+	}
+	return result;
+}
+
 bool BinnedGeometry::check_bin(const std::vector<Edge*>& edges) {
 	// quadratic-time brute force
 	int n = edges.size();
@@ -136,6 +176,27 @@ void BinnedGeometry::draw_pixel(int x, int y, Edge* e) {
 	buffer[y * W + x].push_back(e);
 }
 
+vector<Vertex*> BinnedGeometry::overlapping_vertices(const vector<Vertex*>& vertices) {
+	// vertices at exactly the same position end up next to each other
+	vector<Vertex*> sorted(vertices);
+	std::sort(sorted.begin(), sorted.end(), [](Vertex* a, Vertex* b) {
+		return a->current.x < b->current.x || (a->current.x == b->current.x && a->current.y < b->current.y);
+	});
+	vector<Vertex*> result;
+	for (size_t i = 0; i < sorted.size(); ) {
+		size_t j = i + 1;
+		bool any_rounded = sorted[i]->is_rounded;
+		while (j < sorted.size() && sorted[j]->current.x == sorted[i]->current.x && sorted[j]->current.y == sorted[i]->current.y) {
+			any_rounded = any_rounded || sorted[j]->is_rounded;
+			++j;
+		}
+		// as in check_vertex_overlap, every vertex of the group meets a rounded one other than itself
+		if (any_rounded && j - i > 1) result.insert(result.end(), sorted.begin() + i, sorted.begin() + j);
+		i = j;
+	}
+	return result;
+}
+
 bool BinnedGeometry::check_vertex_overlap(const std::vector<Vertex*>& vertices, Vertex* v) {
 	for (Vertex* u : vertices) {
 		if (u->is_rounded && u != v) {
@@ -143,4 +204,82 @@ bool BinnedGeometry::check_vertex_overlap(const std::vector<Vertex*>& vertices,
 		}
 	}
 	return true;
-}
\ No newline at end of file
+}
+GeometryBins::GeometryBins(const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
+	// about one vertex per bin, but no bins smaller than a grid cell
+	double minX = numeric_limits<double>::max(), maxX = numeric_limits<double>::lowest();
+	double minY = numeric_limits<double>::max(), maxY = numeric_limits<double>::lowest();
+	for (Vertex* v : vertices) {
+		minX = std::min(minX, v->current.x);
+		maxX = std::max(maxX, v->current.x);
+		minY = std::min(minY, v->current.y);
+		maxY = std::max(maxY, v->current.y);
+	}
+	bin_size = 1;
+	if (!vertices.empty()) bin_size = std::max(1.0, std::max(maxX - minX, maxY - minY) / std::sqrt(static_cast<double>(vertices.size())));
+	for (Vertex* v : vertices) bins[key(bin_of(v->current.x), bin_of(v->current.y))].vertices.push_back(v);
+	for (Edge* e : edges) insert(e, e->a->current, e->b->current);
+}
+
+template<typename F>
+void GeometryBins::for_each_bin(const Vertex::Point& p, const Vertex::Point& q, F f) {
+	// column by column; bins are taken as closed and slightly widened against rounding
+	const double eps = 1e-9 * bin_size;
+	double x_lo = std::min(p.x, q.x), x_hi = std::max(p.x, q.x);
+	for (long long bx = bin_of(x_lo - eps); bx <= bin_of(x_hi + eps); ++bx) {
+		double y_lo = std::min(p.y, q.y), y_hi = std::max(p.y, q.y);
+		if (p.x != q.x) {
+			double slope = (q.y - p.y) / (q.x - p.x);
+			double y_a = p.y + slope * (std::max(x_lo, bx * bin_size) - p.x);
+			double y_b = p.y + slope * (std::min(x_hi, (bx + 1) * bin_size) - p.x);
+			y_lo = std::min(y_a, y_b);
+			y_hi = std::max(y_a, y_b);
+		}
+		for (long long by = bin_of(y_lo - eps); by <= bin_of(y_hi + eps); ++by) f(bins[key(bx, by)]);
+	}
+}
+
+void GeometryBins::insert(Edge* e, const Vertex::Point& p, const Vertex::Point& q) {
+	for_each_bin(p, q, [e](Bin& bin) { bin.edges.push_back(e); });
+}
+
+void GeometryBins::remove(Edge* e, const Vertex::Point& p, const Vertex::Point& q) {
+	for_each_bin(p, q, [e](Bin& bin) {
+		auto it = std::find(bin.edges.begin(), bin.edges.end(), e);
+		if (it != bin.edges.end()) {
+			*it = bin.edges.back();
+			bin.edges.pop_back();
+		}
+	});
+}
+
+void GeometryBins::moved(Vertex* v, const Vertex::Point& from) {
+	vector<Vertex*>& old_bin = bins[key(bin_of(from.x), bin_of(from.y))].vertices;
+	auto it = std::find(old_bin.begin(), old_bin.end(), v);
+	if (it != old_bin.end()) {
+		*it = old_bin.back();
+		old_bin.pop_back();
+	}
+	bins[key(bin_of(v->current.x), bin_of(v->current.y))].vertices.push_back(v);
+	for (Edge* e : v->N) {
+		const Vertex::Point& other = e->other(v)->current;
+		remove(e, from, other);
+		insert(e, v->current, other);
+	}
+}
+
+void GeometryBins::gather(double x0, double y0, double x1, double y1, vector<Vertex*>& near_vertices, vector<Edge*>& near_edges) const {
+	near_vertices.clear();
+	near_edges.clear();
+	for (long long bx = bin_of(x0); bx <= bin_of(x1); ++bx) {
+		for (long long by = bin_of(y0); by <= bin_of(y1); ++by) {
+			auto bin = bins.find(key(bx, by));
+			if (bin == bins.end()) continue;
+			near_vertices.insert(near_vertices.end(), bin->second.vertices.begin(), bin->second.vertices.end());
+			near_edges.insert(near_edges.end(), bin->second.edges.begin(), bin->second.edges.end());
+		}
+	}
+	// long edges lie in several bins
+	std::sort(near_edges.begin(), near_edges.end());
+	near_edges.erase(std::unique(near_edges.begin(), near_edges.end()), near_edges.end());
+}
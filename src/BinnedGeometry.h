@@ -1,23 +1,64 @@
 #ifndef INCLUDED_BINNED_GEOMETRY
 #define INCLUDED_BINNED_GEOMETRY
 
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
 
 #include "Vertex.h"
 #include "Edge.h"
 
+// Checks drawings by binning the edges on a fixed grid over the bounding box. The bins are
+// several megabytes, so an instance is best kept and reused for repeated checks.
 struct BinnedGeometry {
+	std::vector<std::vector<Edge*>> buffer;
 	double minX;
 	double minY;
 	double maxX;
 	double maxY;
 	bool check_intersections(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+	// Every vertex involved in an overlap, a broken rotation system or a crossing (both edges);
+	// empty if and only if check_valid_full holds.
+	std::vector<Vertex*> collect_violations(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+	void fill_bins(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
 	bool check_bin(const std::vector<Edge*>& segs);
 	void draw_edge(Edge* e);
 	void draw_pixel(int x, int y, Edge* s);
 
 	bool check_vertex_overlap(const std::vector<Vertex*>& vertices, Vertex* v);
+	// Every vertex for which check_vertex_overlap fails, found by sorting instead of pairwise.
+	std::vector<Vertex*> overlapping_vertices(const std::vector<Vertex*>& vertices);
 
 };
 
+// Vertices and edges in a uniform grid of bins that follows the drawing as vertices move, so that
+// the geometry near a region is found without scanning the whole graph.
+class GeometryBins {
+public:
+	GeometryBins(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+	// Re-bins v and its edges; call after every committed move of v, before anything else moves.
+	void moved(Vertex* v, const Vertex::Point& from);
+	// Every vertex and edge in a bin that meets the box [x0, x1] x [y0, y1], each once;
+	// the caller filters on the actual geometry.
+	void gather(double x0, double y0, double x1, double y1, std::vector<Vertex*>& near_vertices, std::vector<Edge*>& near_edges) const;
+
+private:
+	struct Bin {
+		std::vector<Vertex*> vertices;
+		std::vector<Edge*> edges;
+	};
+	double bin_size;
+	std::unordered_map<uint64_t, Bin> bins;
+
+	long long bin_of(double x) const { return static_cast<long long>(std::floor(x / bin_size)); }
+	static uint64_t key(long long bx, long long by) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(bx)) << 32) | static_cast<uint32_t>(by);
+	}
+	// Calls f(bin) for every bin the segment from p to q meets, each once.
+	template<typename F>
+	void for_each_bin(const Vertex::Point& p, const Vertex::Point& q, F f);
+	void insert(Edge* e, const Vertex::Point& p, const Vertex::Point& q);
+	void remove(Edge* e, const Vertex::Point& p, const Vertex::Point& q);
+};
+
 #endif //ndef INCLUDED_BINNED_GEOMETRY
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "DensityQuadtree.h"
+
+#include <algorithm>
+#include <limits>
+using std::numeric_limits;
+using std::vector;
+
+void DensityQuadtree::build(const vector<Vertex*>& vertices) {
+	vector<Entry> entries;
+	entries.reserve(vertices.size());
+	for (Vertex* v : vertices) entries.push_back({ v, v->current });
+	build(entries);
+}
+
+void DensityQuadtree::build(const vector<Entry>& entries) {
+	double min_x = numeric_limits<double>::max();
+	double min_y = numeric_limits<double>::max();
+	double max_x = numeric_limits<double>::lowest();
+	double max_y = numeric_limits<double>::lowest();
+	for (const Entry& e : entries) {
+		min_x = std::min(min_x, e.p.x);
+		max_x = std::max(max_x, e.p.x);
+		min_y = std::min(min_y, e.p.y);
+		max_y = std::max(max_y, e.p.y);
+	}
+	// leave room for vertices to move before a rebuild is needed
+	double size = std::max(max_x - min_x, max_y - min_y);
+	double margin = 0.1 * size + 2;
+	nodes.clear();
+	nodes.push_back(Node());
+	nodes[0].x0 = min_x - margin;
+	nodes[0].y0 = min_y - margin;
+	nodes[0].size = size + 2 * margin;
+	for (const Entry& e : entries) insert(e);
+}
+
+int DensityQuadtree::child_for(const Node& n, const Vertex::Point& p) const {
+	double half = n.size / 2;
+	int quadrant = (p.x >= n.x0 + half ? 1 : 0) + (p.y >= n.y0 + half ? 2 : 0);
+	return n.first_child + quadrant;
+}
+
+void DensityQuadtree::split(int node) {
+	int first_child = nodes.size();
+	double half = nodes[node].size / 2;
+	for (int quadrant = 0; quadrant < 4; ++quadrant) {
+		Node child;
+		child.x0 = nodes[node].x0 + (quadrant & 1 ? half : 0);
+		child.y0 = nodes[node].y0 + (quadrant & 2 ? half : 0);
+		child.size = half;
+		nodes.push_back(child);
+	}
+	nodes[node].first_child = first_child;
+	vector<Entry> entries;
+	entries.swap(nodes[node].entries);
+	for (const Entry& e : entries) {
+		Node& child = nodes[child_for(nodes[node], e.p)];
+		++child.count;
+		child.sum_x += e.p.x;
+		child.sum_y += e.p.y;
+		child.entries.push_back(e);
+	}
+}
+
+void DensityQuadtree::insert(const Entry& e) {
+	int node = 0;
+	int depth = 0;
+	while (true) {
+		Node& n = nodes[node];
+		++n.count;
+		n.sum_x += e.p.x;
+		n.sum_y += e.p.y;
+		if (n.first_child < 0) break;
+		node = child_for(n, e.p);
+		++depth;
+	}
+	nodes[node].entries.push_back(e);
+	if (nodes[node].entries.size() > leaf_capacity && depth < max_depth) split(node);
+}
+
+void DensityQuadtree::remove(Vertex* v, const Vertex::Point& p) {
+	int node = 0;
+	while (true) {
+		Node& n = nodes[node];
+		--n.count;
+		n.sum_x -= p.x;
+		n.sum_y -= p.y;
+		if (n.first_child < 0) break;
+		node = child_for(n, p);
+	}
+	vector<Entry>& entries = nodes[node].entries;
+	auto it = std::find_if(entries.begin(), entries.end(), [v](const Entry& e) { return e.v == v; });
+	*it = entries.back();
+	entries.pop_back();
+}
+
+void DensityQuadtree::move(Vertex* v, const Vertex::Point& from, const Vertex::Point& to) {
+	if (!inside(nodes[0], to)) {
+		// left the root square; rebuild around the new extent
+		vector<Entry> entries;
+		for (const Node& n : nodes) {
+			for (const Entry& e : n.entries) entries.push_back(e.v == v ? Entry{ v, to } : e);
+		}
+		build(entries);
+		return;
+	}
+	remove(v, from);
+	insert({ v, to });
+}
+
+double DensityQuadtree::density_at(const Vertex::Point& p, const Vertex* exclude) const {
+	const double theta_sqr = theta * theta;
+	double density = 0;
+	int stack[4 * max_depth + 4];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0) {
+		const Node& n = nodes[stack[--stack_size]];
+		if (n.count == 0) continue;
+		if (n.first_child < 0) {
+			for (const Entry& e : n.entries) {
+				if (e.v != exclude) density += 1.0 / distance_sqr(e.p, p);
+			}
+			continue;
+		}
+		// a node that contains p is always opened, so `exclude` is never part of an approximation
+		if (!inside(n, p)) {
+			Vertex::Point center{ n.sum_x / n.count, n.sum_y / n.count };
+			double d = distance_sqr(center, p);
+			if (n.size * n.size < theta_sqr * d) {
+				density += n.count / d;
+				continue;
+			}
+		}
+		for (int i = 0; i < 4; ++i) stack[stack_size++] = n.first_child + i;
+	}
+	return density;
+}
@@ -0,0 +1,51 @@
+#ifndef INCLUDED_DENSITY_QUADTREE
+#define INCLUDED_DENSITY_QUADTREE
+
+#include <vector>
+
+#include "Vertex.h"
+
+// Quadtree over vertex positions for Barnes-Hut approximation of the density sum of 1/d^2.
+// A node is approximated by its point count at its center of mass if size / distance < theta.
+// The tree stores positions itself, so it stays consistent while vertices move, as long as
+// every move is passed through move().
+class DensityQuadtree {
+public:
+	DensityQuadtree(double theta) : theta(theta) {}
+
+	void build(const std::vector<Vertex*>& vertices);
+	void move(Vertex* v, const Vertex::Point& from, const Vertex::Point& to);
+
+	// Approximate sum of 1/d^2 from p to all vertices in the tree except `exclude`.
+	double density_at(const Vertex::Point& p, const Vertex* exclude) const;
+
+private:
+	struct Entry {
+		Vertex* v;
+		Vertex::Point p;
+	};
+	struct Node {
+		double x0, y0, size;
+		int count = 0;
+		double sum_x = 0;
+		double sum_y = 0;
+		int first_child = -1; // children are stored consecutively; -1 for a leaf
+		std::vector<Entry> entries;
+	};
+	static const int leaf_capacity = 8;
+	static const int max_depth = 32;
+
+	double theta;
+	std::vector<Node> nodes;
+
+	void build(const std::vector<Entry>& entries);
+	bool inside(const Node& n, const Vertex::Point& p) const {
+		return p.x >= n.x0 && p.x < n.x0 + n.size && p.y >= n.y0 && p.y < n.y0 + n.size;
+	}
+	int child_for(const Node& n, const Vertex::Point& p) const;
+	void insert(const Entry& e);
+	void remove(Vertex* v, const Vertex::Point& p);
+	void split(int node);
+};
+
+#endif //ndef INCLUDED_DENSITY_QUADTREE
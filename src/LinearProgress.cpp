@@ -1,6 +1,7 @@
 #include "LinearProgress.h"
 
 #include "Logging.h"
+#include "AnnealingStats.h"
 
 using namespace std;
 
@@ -36,4 +37,7 @@ void LinearProgress::message(double score) {
 	else {
 		console->info("{0} {2:.4} {1}/sec, total {3} sec: {4}", task_name, unit, per_second, std::ceil(duration), score);
 	}
+	if (stats) {
+		console->info("{0}{1}", task_name, stats->summary());
+	}
 }
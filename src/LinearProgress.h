@@ -5,6 +5,8 @@
 #include <string_view>
 #include <chrono>
 
+class AnnealingStats;
+
 class LinearProgress {
 public:
 	LinearProgress(std::string_view task_name, std::string_view unit, int n);
@@ -19,6 +21,10 @@ public:
 
 	void message(double score);
 
+	// optional telemetry reported along with every message
+	const AnnealingStats* stats = nullptr;
+	void attach(const AnnealingStats& s) { stats = &s; }
+
 	std::chrono::time_point<std::chrono::system_clock> start_time;
 	std::chrono::time_point<std::chrono::system_clock> last_message_time;
 
@@ -0,0 +1,66 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// an empty file cannot be mapped, but is still a file
+static const char empty_contents[] = "";
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename) {
+	file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		file_handle = nullptr;
+		return;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size)) return;
+	length = static_cast<size_t>(file_size.QuadPart);
+	if (length == 0) {
+		contents = empty_contents;
+		return;
+	}
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle == nullptr) return;
+	contents = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+}
+
+MappedFile::~MappedFile() {
+	if (contents != nullptr && contents != empty_contents) UnmapViewOfFile(contents);
+	if (mapping_handle != nullptr) CloseHandle(mapping_handle);
+	if (file_handle != nullptr) CloseHandle(file_handle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename) {
+	descriptor = open(filename.c_str(), O_RDONLY);
+	if (descriptor < 0) return;
+	struct stat status;
+	if (fstat(descriptor, &status) != 0) return;
+	length = static_cast<size_t>(status.st_size);
+	if (length == 0) {
+		contents = empty_contents;
+		return;
+	}
+	void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	if (mapping == MAP_FAILED) return;
+	madvise(mapping, length, MADV_SEQUENTIAL);
+	contents = static_cast<const char*>(mapping);
+}
+
+MappedFile::~MappedFile() {
+	if (contents != nullptr && contents != empty_contents) munmap(const_cast<char*>(contents), length);
+	if (descriptor >= 0) close(descriptor);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef INCLUDED_MAPPED_FILE
+#define INCLUDED_MAPPED_FILE
+
+#include <string>
+#include <cstddef>
+
+// Read-only view of a whole file, mapped into memory instead of read through a stream.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& filename);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool is_open() const { return contents != nullptr; }
+	const char* data() const { return contents; }
+	size_t size() const { return length; }
+
+private:
+	const char* contents = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int descriptor = -1;
+#endif
+};
+
+#endif //ndef INCLUDED_MAPPED_FILE
@@ -14,9 +14,10 @@ using std::function;
 
 #include "Checkpoint.h"
 #include "geometry_help.h"
+#include "BinnedGeometry.h"
 
 void Vertex::set_rounded_state() {
-	is_rounded = current.x == std::floor(current.x) && current.y == std::floor(current.y);
+	is_rounded = is_grid_point(current);
 }
 
 double Vertex::rounding_cost() {
@@ -75,11 +76,18 @@ double distance_sqr(const Vertex* u, const Vertex* v) {
 	return dx * dx + dy * dy;
 }
 
-bool Vertex::climb(vector<Vertex*>& vertices, vector<Edge*>& edges) {
-	double score = 0;
-	int best_dx = 0;
-	int best_dy = 0;
+double distance_sqr(const Vertex::Point& p, const Vertex::Point& q) {
+	double dx = p.x - q.x;
+	double dy = p.y - q.y;
+	return dx * dx + dy * dy;
+}
+
+bool Vertex::climb(GeometryBins& bins) {
+	// only positions that improve on the current one need checking
 	double score_best = rounding_cost();
+	Point candidates[8];
+	double scores[8];
+	int num_candidates = 0;
 	for (int dx = -1; dx < 2; ++dx) {
 		for (int dy = -1; dy < 2; ++dy) {
 			if (dx == 0 && dy == 0) continue;
@@ -88,20 +96,24 @@ bool Vertex::climb(vector<Vertex*>& vertices, vector<Edge*>& edges) {
 			current.y += dy;
 			double score_here = rounding_cost();
 			if (score_here < score_best) {
-				if (check_valid_after_move(this, vertices, edges)) {
-					best_dx = dx;
-					best_dy = dy;
-					score_best = score_here;
-				}
+				candidates[num_candidates] = current;
+				scores[num_candidates] = score_here;
+				++num_candidates;
 			}
 		}
 	}
-	if (best_dx != 0 || best_dy != 0) {
-		current.x += best_dx;
-		current.y += best_dy;
-		return true;
-	}
-	else {
-		return false;
+	if (num_candidates == 0) return false;
+	std::uint64_t valid = check_candidates(this, candidates, num_candidates, bins);
+	int best = -1;
+	for (int i = 0; i < num_candidates; ++i) {
+		if ((valid & (std::uint64_t(1) << i)) && scores[i] < score_best) {
+			best = i;
+			score_best = scores[i];
+		}
 	}
+	if (best < 0) return false;
+	Point from = current;
+	current = candidates[best];
+	bins.moved(this, from);
+	return true;
 }
\ No newline at end of file
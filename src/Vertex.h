@@ -7,6 +7,7 @@
 #include <cmath>
 
 class Edge;
+class GeometryBins;
 
 class Vertex {
 public:
@@ -56,13 +57,18 @@ public:
 		}
 	}
 
-	bool climb(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
+	bool climb(GeometryBins& bins);
 
 };
 
 bool operator<(const Vertex& a, const Vertex& b);
 
 double distance_sqr(const Vertex* u, const Vertex* v);
+double distance_sqr(const Vertex::Point& p, const Vertex::Point& q);
+
+inline bool is_grid_point(const Vertex::Point& p) {
+	return p.x == std::floor(p.x) && p.y == std::floor(p.y);
+}
 
 typedef std::vector<Vertex*> Vertices;
 
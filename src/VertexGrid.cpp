@@ -0,0 +1,15 @@
+#include "VertexGrid.h"
+
+#include <algorithm>
+using std::vector;
+
+void VertexGrid::remove(Vertex* v, const Vertex::Point& p) {
+	auto cell = cells.find(key(cell_of(p.x), cell_of(p.y)));
+	if (cell == cells.end()) return;
+	vector<Vertex*>& bucket = cell->second;
+	auto it = std::find(bucket.begin(), bucket.end(), v);
+	if (it != bucket.end()) {
+		*it = bucket.back();
+		bucket.pop_back();
+	}
+}
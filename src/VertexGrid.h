@@ -0,0 +1,46 @@
+#ifndef INCLUDED_VERTEX_GRID
+#define INCLUDED_VERTEX_GRID
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+
+#include "Vertex.h"
+
+// Uniform grid of buckets for finding the vertices near a point.
+// Positions are passed explicitly, so the grid can index either current or original coordinates.
+class VertexGrid {
+public:
+	VertexGrid(double cell_size) : cell_size(cell_size) {}
+
+	void clear() { cells.clear(); }
+	void insert(Vertex* v, const Vertex::Point& p) { cells[key(cell_of(p.x), cell_of(p.y))].push_back(v); }
+	void remove(Vertex* v, const Vertex::Point& p);
+
+	// Calls f(u) for every vertex u in a cell that intersects the square of the given radius around p;
+	// the caller filters on the actual distance.
+	template<typename F>
+	void for_each_near(const Vertex::Point& p, double radius, F f) const {
+		int x0 = cell_of(p.x - radius), x1 = cell_of(p.x + radius);
+		int y0 = cell_of(p.y - radius), y1 = cell_of(p.y + radius);
+		for (int cx = x0; cx <= x1; ++cx) {
+			for (int cy = y0; cy <= y1; ++cy) {
+				auto cell = cells.find(key(cx, cy));
+				if (cell == cells.end()) continue;
+				for (Vertex* u : cell->second) f(u);
+			}
+		}
+	}
+
+private:
+	double cell_size;
+	std::unordered_map<uint64_t, std::vector<Vertex*>> cells;
+
+	int cell_of(double x) const { return static_cast<int>(std::floor(x / cell_size)); }
+	static uint64_t key(int cx, int cy) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) | static_cast<uint32_t>(cy);
+	}
+};
+
+#endif //ndef INCLUDED_VERTEX_GRID
@@ -0,0 +1,60 @@
+#ifndef INCLUDED_WEIGHTED_SAMPLER
+#define INCLUDED_WEIGHTED_SAMPLER
+
+#include <vector>
+#include <random>
+
+// Samples an index with probability proportional to its weight; weights can be changed in O(log n).
+// The weights live in the leaves of a complete binary tree whose internal nodes hold the sums of
+// their children; those are recomputed from the children on every change, so they do not drift.
+class WeightedSampler {
+public:
+	void assign(size_t n) {
+		size = n;
+		leaves = 1;
+		while (leaves < n) leaves *= 2;
+		tree.assign(2 * leaves, 0.0);
+	}
+
+	void set(size_t i, double weight) {
+		size_t node = leaves + i;
+		tree[node] = weight;
+		for (node /= 2; node > 0; node /= 2) tree[node] = tree[2 * node] + tree[2 * node + 1];
+	}
+
+	// Set many weights with set_leaf, then call rebuild once: O(n) instead of O(n log n).
+	void set_leaf(size_t i, double weight) { tree[leaves + i] = weight; }
+	void rebuild() {
+		for (size_t node = leaves - 1; node > 0; --node) tree[node] = tree[2 * node] + tree[2 * node + 1];
+	}
+
+	double total() const { return tree[1]; }
+
+	// Uniform over all indices if every weight is zero.
+	template<typename RNG>
+	size_t sample(RNG& rng) const {
+		if (!(total() > 0)) {
+			std::uniform_int_distribution<size_t> uniform(0, size - 1);
+			return uniform(rng);
+		}
+		std::uniform_real_distribution<double> uniform(0, total());
+		double u = uniform(rng);
+		size_t node = 1;
+		while (node < leaves) {
+			double left = tree[2 * node];
+			if (u < left || !(tree[2 * node + 1] > 0)) node = 2 * node;
+			else {
+				u -= left;
+				node = 2 * node + 1;
+			}
+		}
+		return node - leaves;
+	}
+
+private:
+	size_t size = 0;
+	size_t leaves = 1;
+	std::vector<double> tree = std::vector<double>(2, 0.0);
+};
+
+#endif //ndef INCLUDED_WEIGHTED_SAMPLER
@@ -0,0 +1,141 @@
+#include "agb_file.h"
+
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
+#include <fstream>
+using std::ofstream;
+
+using std::string;
+using std::vector;
+
+#include "Vertex.h"
+#include "Edge.h"
+#include "Logging.h"
+#include "Timer.h"
+#include "MappedFile.h"
+
+Edge* make_edge(Vertex* p, Vertex* q);
+
+static const char agb_magic[8] = { 'A', 'R', 'M', 'A', 'G', 'B', '0', '1' };
+static const size_t agb_header_size = sizeof(agb_magic) + 2 * sizeof(uint64_t);
+static const size_t agb_vertex_size = 4 * sizeof(double);
+static const size_t agb_edge_size = 2 * sizeof(uint32_t);
+
+bool load_agbfile(const string& filename, vector<Vertex*>& vertices, vector<Edge*>& edges) {
+	console->info("Loading agb file...");
+	Timer load_time;
+
+	MappedFile file(filename);
+	if (!file.is_open()) {
+		console->error("agb reader failed to open '{}'", filename);
+		return false;
+	}
+	const char* data = file.data();
+	if (file.size() < agb_header_size || std::memcmp(data, agb_magic, sizeof(agb_magic)) != 0) {
+		console->error("'{}' is not an agb file", filename);
+		return false;
+	}
+	uint64_t num_vertices, num_edges;
+	std::memcpy(&num_vertices, data + sizeof(agb_magic), sizeof(uint64_t));
+	std::memcpy(&num_edges, data + sizeof(agb_magic) + sizeof(uint64_t), sizeof(uint64_t));
+	// bound each count by the file size first, so that the total below cannot overflow
+	const uint64_t payload_size = file.size() - agb_header_size;
+	if (num_vertices > payload_size / agb_vertex_size || num_edges > payload_size / agb_edge_size ||
+		file.size() != agb_header_size + num_vertices * agb_vertex_size + num_edges * agb_edge_size) {
+		console->error("agb file '{}' is truncated or has a wrong header", filename);
+		return false;
+	}
+	if (num_vertices > INT_MAX) {
+		console->error("agb file '{}' has more vertices than ids can number", filename);
+		return false;
+	}
+
+	// the arrays need not be aligned in the mapping, so values are copied out
+	const size_t first_vertex = vertices.size(), first_edge = edges.size();
+	const char* vertex_data = data + agb_header_size;
+	vertices.reserve(vertices.size() + num_vertices);
+	for (uint64_t i = 0; i < num_vertices; ++i) {
+		double xy[4];
+		std::memcpy(xy, vertex_data + i * agb_vertex_size, agb_vertex_size);
+		Vertex* v = new Vertex(xy[0], xy[1]);
+		v->current = { xy[2], xy[3] };
+		v->set_rounded_state();
+		v->id = static_cast<int>(i);
+		vertices.push_back(v);
+	}
+	const char* edge_data = vertex_data + num_vertices * agb_vertex_size;
+	edges.reserve(edges.size() + num_edges);
+	for (uint64_t i = 0; i < num_edges; ++i) {
+		uint32_t ab[2];
+		std::memcpy(ab, edge_data + i * agb_edge_size, agb_edge_size);
+		if (ab[0] >= num_vertices || ab[1] >= num_vertices) {
+			console->error("agb file '{}' has an edge endpoint out of range", filename);
+			// take back what was read so far
+			for (size_t k = first_edge; k < edges.size(); ++k) delete edges[k];
+			edges.resize(first_edge);
+			for (size_t k = first_vertex; k < vertices.size(); ++k) delete vertices[k];
+			vertices.resize(first_vertex);
+			return false;
+		}
+		Edge* e = make_edge(vertices[ab[0]], vertices[ab[1]]);
+		if (e != nullptr) edges.push_back(e);
+	}
+
+	console->info("Number of points: {}", vertices.size());
+	console->info("Number of segments: {}", edges.size());
+	console->info("Loading time = {} s.", load_time.elapsed().count());
+	return true;
+}
+
+bool write_agbfile(const string& filename, const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
+	// edges refer to vertices by index, so the ids must be the indices, as the loader makes them
+	if (vertices.size() > INT_MAX) {
+		console->error("Cannot write '{}': more vertices than ids can number", filename);
+		return false;
+	}
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		if (vertices[i]->id != static_cast<int>(i)) {
+			console->error("Cannot write '{}': vertex {} has id {}", filename, i, vertices[i]->id);
+			return false;
+		}
+	}
+	for (Edge* e : edges) {
+		for (Vertex* v : { e->a, e->b }) {
+			if (v->id < 0 || v->id >= static_cast<int>(vertices.size()) || vertices[v->id] != v) {
+				console->error("Cannot write '{}': an edge ends at vertex {}, which is not in the graph", filename, v->id);
+				return false;
+			}
+		}
+	}
+	ofstream out(filename, std::ios::binary);
+	if (!out.is_open()) {
+		console->error("Could not open '{}' for writing", filename);
+		return false;
+	}
+	// assemble the arrays and write each in one go
+	vector<double> coordinates;
+	coordinates.reserve(4 * vertices.size());
+	for (Vertex* v : vertices) {
+		coordinates.insert(coordinates.end(), { v->original.x, v->original.y, v->current.x, v->current.y });
+	}
+	vector<uint32_t> endpoints;
+	endpoints.reserve(2 * edges.size());
+	for (Edge* e : edges) {
+		endpoints.push_back(static_cast<uint32_t>(e->a->id));
+		endpoints.push_back(static_cast<uint32_t>(e->b->id));
+	}
+	uint64_t num_vertices = vertices.size();
+	uint64_t num_edges = edges.size();
+	out.write(agb_magic, sizeof(agb_magic));
+	out.write(reinterpret_cast<const char*>(&num_vertices), sizeof(num_vertices));
+	out.write(reinterpret_cast<const char*>(&num_edges), sizeof(num_edges));
+	out.write(reinterpret_cast<const char*>(coordinates.data()), coordinates.size() * sizeof(double));
+	out.write(reinterpret_cast<const char*>(endpoints.data()), endpoints.size() * sizeof(uint32_t));
+	if (!out) {
+		console->error("Failed writing '{}'", filename);
+		return false;
+	}
+	return true;
+}
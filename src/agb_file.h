@@ -0,0 +1,19 @@
+#ifndef INCLUDED_AGB_FILE
+#define INCLUDED_AGB_FILE
+
+#include <string>
+#include <vector>
+
+class Vertex;
+class Edge;
+
+// Binary counterpart of the agf format, loaded by mapping the file instead of parsing it.
+// Layout (native byte order): magic "ARMAGB01", uint64 number of vertices, uint64 number of edges,
+// then per vertex the doubles original x, original y, current x, current y,
+// then per edge the uint32 ids of its endpoints.
+// On failure, vertices and edges are left as they were.
+bool load_agbfile(const std::string& filename, std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
+// Fails without writing unless vertices[i]->id == i for all i and every edge ends at those vertices.
+bool write_agbfile(const std::string& filename, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+
+#endif //ndef INCLUDED_AGB_FILE
@@ -2,92 +2,133 @@
 using std::string;
 using std::vector;
 
-#include <map>
-using std::map;
-using std::make_pair;
-
-#include <limits>
-using std::numeric_limits;
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
 
 #include <fstream>
-using std::ifstream;
 using std::ofstream;
-using std::getline;
-
-#include <string>
-using std::stoi;
-using std::stod;
 
-#include <sstream>
-using std::stringstream;
+#include <future>
 
 #include "Vertex.h"
 #include "Edge.h"
 #include "Logging.h"
 #include "Timer.h"
 #include "load_shapefile.h"
+#include "MappedFile.h"
 
 Edge* make_edge(Vertex* p, Vertex* q);
 
+namespace {
+
+// Integers are always read with from_chars; doubles only where the library has it (GCC 11 and later).
+template<typename T>
+std::from_chars_result parse_number(const char* first, const char* last, T& value) {
+	return std::from_chars(first, last, value);
+}
+#ifndef __cpp_lib_to_chars
+std::from_chars_result parse_number(const char* first, const char* last, double& value) {
+	// strtod needs a terminated string, which the mapped file is not
+	char token[64];
+	size_t length = 0;
+	while (first + length < last && length + 1 < sizeof(token) && first[length] != ' ' && first[length] != '\t' && first[length] != '\r' && first[length] != '\n') {
+		token[length] = first[length];
+		++length;
+	}
+	token[length] = '\0';
+	char* token_end;
+	value = std::strtod(token, &token_end);
+	if (token_end == token || length + 1 == sizeof(token)) return { first, std::errc::invalid_argument };
+	return { first + (token_end - token), std::errc() };
+}
+#endif
+
+// Reads numbers from the mapped text; a line may end in \n or \r\n.
+struct AgfParser {
+	const char* p;
+	const char* end;
+	int line = 1;
+
+	void skip_blanks() {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+	}
+	bool at_line_end() {
+		skip_blanks();
+		return p == end || *p == '\n';
+	}
+	void next_line() {
+		while (p < end && *p != '\n') ++p;
+		if (p < end) ++p;
+		++line;
+	}
+	template<typename T>
+	bool read(T& value) {
+		skip_blanks();
+		// from_chars takes no plus sign, but the stod and stoi it replaced did
+		const char* start = p;
+		if (end - start > 1 && start[0] == '+' && start[1] != '-') ++start;
+		auto [next, error] = parse_number(start, end, value);
+		if (error != std::errc()) return false;
+		p = next;
+		return true;
+	}
+};
+
+}
+
 bool load_agffile(const string& filename, vector<Vertex*>& vertices, vector<Edge*>& edges) {
 	console->info("Loading agf file...");
 	Timer load_time;
 
-	typedef std::map<int, Vertex*> VertexMap;
-	VertexMap vertexMap;
-
-	ifstream file(filename);
+	MappedFile file(filename);
 	if (!file.is_open()) {
 		console->error("agf reader failed to open '{}'", filename);
 		return false;
 	}
+	AgfParser parser{ file.data(), file.data() + file.size() };
+	const size_t first_vertex = vertices.size(), first_edge = edges.size();
+	auto fail = [&](const char* what) {
+		console->error("agf reader: {} on line {} of '{}'", what, parser.line, filename);
+		// take back what was read so far
+		for (size_t i = first_edge; i < edges.size(); ++i) delete edges[i];
+		edges.resize(first_edge);
+		for (size_t i = first_vertex; i < vertices.size(); ++i) delete vertices[i];
+		vertices.resize(first_vertex);
+		return false;
+	};
 
 	int numNodes = 0, numEdges = 0;
-
-	int num_hits = 0;
-	int num_entries = 0;
-	int num_zero_segments_skipped = 0;
-
-	string line;
-
-	getline(file, line);
-	numNodes = stoi(line); // read number of nodes for vertex-reading for-loop
-
-	getline(file, line);
-	numEdges = stoi(line);
+	if (!parser.read(numNodes) || numNodes < 0) return fail("expected number of nodes");
+	parser.next_line();
+	if (!parser.read(numEdges) || numEdges < 0) return fail("expected number of edges");
+	parser.next_line();
+	vertices.reserve(vertices.size() + numNodes);
+	edges.reserve(edges.size() + numEdges);
 
 	for (int i = 0; i < numNodes; ++i) {
-		getline(file, line);
-		stringstream linestream(line);
-
-		string part;
-		getline(linestream, part, ' ');
-		double xCoord = stod(part);
-
-		getline(linestream, part, ' ');
-		double yCoord = stod(part);
+		double xCoord, yCoord;
+		if (!parser.read(xCoord) || !parser.read(yCoord)) return fail("expected vertex coordinates");
 
 		Vertex* c = new Vertex(xCoord, yCoord);
 		vertices.push_back(c);
 		c->id = i;
 
-		if (getline(linestream, part, ' ')) {
-			double xCoordRound = stod(part, nullptr);
-			getline(linestream, part, ' ');
-			double yCoordRound = stod(part, nullptr);
+		if (!parser.at_line_end()) {
+			double xCoordRound, yCoordRound;
+			if (!parser.read(xCoordRound) || !parser.read(yCoordRound)) return fail("expected rounded coordinates");
 			c->current = { xCoordRound, yCoordRound };
 			c->set_rounded_state();
 		}
+		parser.next_line();
 	}
 
 	for (int i = 0; i < numEdges; ++i) {
-		getline(file, line);
-		stringstream linestream(line);
-		string part;
-		getline(linestream, part, ' ');
-		int a_id = stoi(part);
-		getline(linestream, part, ' ');
-		int b_id = stoi(part);
+		int a_id, b_id;
+		if (!parser.read(a_id) || !parser.read(b_id)) return fail("expected edge endpoints");
+		if (a_id < 0 || a_id >= numNodes || b_id < 0 || b_id >= numNodes) return fail("edge endpoint out of range");
+		parser.next_line();
 
 		Edge* e = make_edge(vertices[a_id], vertices[b_id]);
 		if (e != nullptr) edges.push_back(e);
@@ -96,21 +137,104 @@ bool load_agffile(const string& filename, vector<Vertex*>& vertices, vector<Edge
 	console->info("Number of points: {}", vertices.size());
 	console->info("Number of segments: {}", edges.size());
 
-	console->info("Loading time = {} s.", load_time.elapsed().count());
+	double seconds = load_time.elapsed().count();
+	console->info("Loading time = {} s ({:.0f} MB/s).", seconds, file.size() / (1024.0 * 1024.0) / seconds);
 	return true;
 }
 
-void write_agffile(const std::string& filename, std::vector<Vertex*>& vertices, std::vector<Edge*>& edges) {
-	ofstream out(filename);
-	out << vertices.size() << '\n';
-	out << edges.size() << '\n';
+namespace {
+
+// The data of an agf file, copied out of the graph so it can be written while the graph changes.
+struct AgfSnapshot {
+	vector<double> coordinates; // original x, original y, current x, current y per vertex
+	vector<int> endpoints; // two ids per edge
+};
+
+AgfSnapshot take_snapshot(const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
+	AgfSnapshot snapshot;
+	snapshot.coordinates.reserve(4 * vertices.size());
 	for (Vertex* v : vertices) {
-		out << v->original.x << ' '
-			<< v->original.y << ' '
-			<< v->current.x << ' '
-			<< v->current.y << '\n';
+		snapshot.coordinates.insert(snapshot.coordinates.end(), { v->original.x, v->original.y, v->current.x, v->current.y });
 	}
+	snapshot.endpoints.reserve(2 * edges.size());
 	for (Edge* e : edges) {
-		out << e->a->id << ' ' << e->b->id << '\n';
+		snapshot.endpoints.push_back(e->a->id);
+		snapshot.endpoints.push_back(e->b->id);
+	}
+	return snapshot;
+}
+
+// Integers are always written with to_chars; doubles only where the library has it (GCC 11 and later),
+// otherwise with 17 significant digits, which reads back to the same value too but is not the shortest form.
+template<typename T>
+char* format_number(char* first, char* last, T value) {
+	return std::to_chars(first, last, value).ptr;
+}
+#ifndef __cpp_lib_to_chars
+char* format_number(char* first, char* last, double value) {
+	return first + std::snprintf(first, last - first, "%.17g", value);
+}
+#endif
+
+// Formats numbers into a large buffer and hands it to the stream in big chunks.
+// Doubles are written in the shortest form that reads back to the same value, where the library allows.
+class AgfWriter {
+public:
+	explicit AgfWriter(ofstream& out) : out(out), buffer(chunk_size + max_field_size) {}
+
+	template<typename T>
+	void put(T value, char separator) {
+		char* end = format_number(buffer.data() + used, buffer.data() + buffer.size() - 1, value);
+		*end++ = separator;
+		used = end - buffer.data();
+		if (used >= chunk_size) flush();
+	}
+	void flush() {
+		out.write(buffer.data(), used);
+		used = 0;
+	}
+
+private:
+	static const size_t chunk_size = 1 << 20;
+	static const size_t max_field_size = 64; // shortest doubles need at most 24 characters
+	ofstream& out;
+	vector<char> buffer;
+	size_t used = 0;
+};
+
+bool write_snapshot(const string& filename, const AgfSnapshot& snapshot) {
+	ofstream out(filename, std::ios::binary);
+	if (!out.is_open()) {
+		console->error("Could not open '{}' for writing", filename);
+		return false;
+	}
+	AgfWriter writer(out);
+	writer.put(snapshot.coordinates.size() / 4, '\n');
+	writer.put(snapshot.endpoints.size() / 2, '\n');
+	for (size_t i = 0; i < snapshot.coordinates.size(); i += 4) {
+		writer.put(snapshot.coordinates[i], ' ');
+		writer.put(snapshot.coordinates[i + 1], ' ');
+		writer.put(snapshot.coordinates[i + 2], ' ');
+		writer.put(snapshot.coordinates[i + 3], '\n');
 	}
-}
\ No newline at end of file
+	for (size_t i = 0; i < snapshot.endpoints.size(); i += 2) {
+		writer.put(snapshot.endpoints[i], ' ');
+		writer.put(snapshot.endpoints[i + 1], '\n');
+	}
+	writer.flush();
+	if (!out) {
+		console->error("Failed writing '{}'", filename);
+		return false;
+	}
+	return true;
+}
+
+}
+
+bool write_agffile(const std::string& filename, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges) {
+	return write_snapshot(filename, take_snapshot(vertices, edges));
+}
+
+std::future<bool> write_agffile_async(const std::string& filename, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges) {
+	return std::async(std::launch::async, write_snapshot, filename, take_snapshot(vertices, edges));
+}
@@ -1,13 +1,18 @@
 #ifndef INCLUDED_AGF_FILE
 #define INCLUDED_AGF_FILE
 
+#include <future>
 #include <string>
 #include <vector>
 
 class Vertex;
 class Edge;
 
+// On failure, vertices and edges are left as they were.
 bool load_agffile(const std::string& filename, std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
-void write_agffile(const std::string& filename, std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
+bool write_agffile(const std::string& filename, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+// Copies the graph, then writes it on a background thread; the graph may change meanwhile.
+// The future is true once the file was written successfully, and waits for that when destroyed.
+std::future<bool> write_agffile_async(const std::string& filename, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
 
 #endif //ndef INCLUDED_AGF_FILE
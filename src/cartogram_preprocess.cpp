@@ -1,27 +1,36 @@
 #include "cartogram_preprocess.h"
 #include "geometry_help.h"
+#include "BinnedGeometry.h"
 #include "Vertex.h"
 #include "Edge.h"
+#include "VertexGrid.h"
 #include "logging.h"
+#include "Timer.h"
+#include "parallel_for.h"
 
+#include <algorithm>
 #include <cmath>
 #include <tuple>
 using std::tuple;
 
-#include <map>
-using std::map;
-
 using std::vector;
 
 #define CGAL_HEADER_ONLY 1
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Constrained_Delaunay_triangulation_2.h>
+#include <CGAL/Triangulation_vertex_base_with_info_2.h>
+#include <CGAL/Constrained_triangulation_face_base_2.h>
+#include <CGAL/Triangulation_data_structure_2.h>
 using Kernel = CGAL::Exact_predicates_inexact_constructions_kernel;
 using Itag = CGAL::No_intersection_tag;
-using CDT = CGAL::Constrained_Delaunay_triangulation_2<Kernel, CGAL::Default, Itag>;
+using Vb = CGAL::Triangulation_vertex_base_with_info_2<int, Kernel>;
+using Fb = CGAL::Constrained_triangulation_face_base_2<Kernel>;
+using Tds = CGAL::Triangulation_data_structure_2<Vb, Fb>;
+using CDT = CGAL::Constrained_Delaunay_triangulation_2<Kernel, Tds, Itag>;
 using Point = CDT::Point;
 
 #include <Eigen/Sparse>
+#include <Eigen/IterativeLinearSolvers>
 using namespace Eigen;
 
 constexpr int x_id(int i) { return 2 * i; }
@@ -30,14 +39,27 @@ constexpr int y_id(int i) { return 2 * i + 1; }
 constexpr double lerp(double from, double to, double t) {
 	return t * to + (1.0 - t) * from;
 }
-void set_vertices_from_eigen(const vector<Vertex*>& vertices, const VectorXd& x, double t) {
+void set_vertices_from_eigen(const vector<Vertex*>& vertices, const vector<Vertex::Point>& start, const VectorXd& x, double t) {
 	for (Vertex* v : vertices) {
-		v->current.x = lerp(v->original.x, x[x_id(v->id)], t);
-		v->current.y = lerp(v->original.y, x[y_id(v->id)], t);
+		v->current.x = lerp(start[v->id].x, x[x_id(v->id)], t);
+		v->current.y = lerp(start[v->id].y, x[y_id(v->id)], t);
 	}
 }
 
-void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges, bool enlarge_short_edges, bool space_nearby_vertices, bool add_cdt) {
+void set_vertices_from_eigen(const vector<Vertex*>& vertices, const vector<Vertex::Point>& start, const VectorXd& x, const vector<double>& t) {
+	for (Vertex* v : vertices) {
+		v->current.x = lerp(start[v->id].x, x[x_id(v->id)], t[v->id]);
+		v->current.y = lerp(start[v->id].y, x[y_id(v->id)], t[v->id]);
+	}
+}
+
+// One linearised solve; the shape constraints are derived from the current positions, while the
+// position constraints keep pulling towards the original ones. Returns false if it did not move anything.
+bool cartogram_pass(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges, const CartogramSettings& settings) {
+	const vector<Vertex::Point> start = backup_vertices(vertices);
+	const bool enlarge_short_edges = settings.enlarge_short_edges;
+	const bool space_nearby_vertices = settings.space_nearby_vertices;
+	const bool add_cdt = settings.add_cdt;
 
 	// === Settings
 	const double position_weight = 0.1;
@@ -67,19 +89,17 @@ void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edg
 	// too-near constraints
 	vector<tuple<Vertex*, Vertex*>> too_near;
 	if (space_nearby_vertices) {
+		// each unordered pair once, from the vertex with the lower id
+		VertexGrid grid(too_near_distance);
+		for (Vertex* v : vertices) grid.insert(v, v->current);
 		for (Vertex* a : vertices) {
-			for (Vertex* b : vertices) {
-				if (a != b) {
-					double dx = b->original.x - a->original.x;
-					double dy = b->original.y - a->original.y;
-					double length = std::sqrt(dx * dx + dy * dy);
-					const double min_length = std::sqrt(2.0);
-					if (length < too_near_distance) {
-						too_near.emplace_back(a, b);
-					}
+			grid.for_each_near(a->current, too_near_distance, [&](Vertex* b) {
+				if (a->id < b->id && distance_sqr(a->current, b->current) < too_near_distance * too_near_distance) {
+					too_near.emplace_back(a, b);
 				}
-			}
+			});
 		}
+		console->info("Number of too-near pairs = {}", too_near.size());
 	}
 	const int rows_per_too_near = 2;
 	num_rows += too_near.size() * rows_per_too_near;
@@ -89,29 +109,36 @@ void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edg
 	// constrained delaunay triangulation
 	vector<tuple<Vertex*, Vertex*>> delaunay_cons;
 	if (add_cdt) {
+		// bulk insertion spatially sorts the points; each CDT vertex carries the id of its Vertex
+		vector<std::pair<Point, int>> points;
+		points.reserve(vertices.size());
+		for (Vertex* v : vertices) points.emplace_back(Point(v->current.x, v->current.y), v->id);
 		CDT cdt;
-		vector<CDT::Vertex_handle> handles;
-		handles.reserve(vertices.size());
-		map<CDT::Vertex_handle, int> handle_map;
+		cdt.insert(points.begin(), points.end());
+		vector<CDT::Vertex_handle> handles(vertices.size());
+		for (CDT::Finite_vertices_iterator vit = cdt.finite_vertices_begin(); vit != cdt.finite_vertices_end(); ++vit) {
+			handles[vit->info()] = vit;
+		}
 		for (Vertex* v : vertices) {
-			CDT::Vertex_handle h = cdt.insert(Point(v->current.x, v->current.y));
-			handles.push_back(h);
-			handle_map[h] = v->id;
+			// a point that coincides with an earlier one was merged into it
+			if (handles[v->id] == CDT::Vertex_handle()) handles[v->id] = cdt.insert(Point(v->current.x, v->current.y));
 		}
 		for (Edge* e : edges) {
 			cdt.insert_constraint(handles[e->a->id], handles[e->b->id]);
 		}
 		console->info("Number of Delaunay points = {}", cdt.number_of_vertices());
-		for (CDT::Finite_edges_iterator eit = cdt.finite_edges_begin(); eit != cdt.finite_edges_end(); ++eit) {
-			Vertex* a = vertices[handle_map[eit->first->vertex(CDT::cw(eit->second))]];
-			Vertex* b = vertices[handle_map[eit->first->vertex(CDT::ccw(eit->second))]];
-			double dx = b->original.x - a->original.x;
-			double dy = b->original.y - a->original.y;
-			double length = std::sqrt(dx * dx + dy * dy);
-
-			if (length < delaunay_min_length) {
-				delaunay_cons.emplace_back(a, b);
-			}
+		vector<CDT::Edge> cdt_edges(cdt.finite_edges_begin(), cdt.finite_edges_end());
+		vector<char> is_short(cdt_edges.size());
+		parallel_for(0, cdt_edges.size(), [&](size_t i) {
+			const CDT::Edge& e = cdt_edges[i];
+			Vertex* a = vertices[e.first->vertex(CDT::cw(e.second))->info()];
+			Vertex* b = vertices[e.first->vertex(CDT::ccw(e.second))->info()];
+			is_short[i] = distance_sqr(a->current, b->current) < delaunay_min_length * delaunay_min_length;
+		});
+		for (size_t i = 0; i < cdt_edges.size(); ++i) {
+			if (!is_short[i]) continue;
+			const CDT::Edge& e = cdt_edges[i];
+			delaunay_cons.emplace_back(vertices[e.first->vertex(CDT::cw(e.second))->info()], vertices[e.first->vertex(CDT::ccw(e.second))->info()]);
 		}
 		console->info("Number of Delaunay constraints to add = {}", delaunay_cons.size());
 	}
@@ -121,24 +148,38 @@ void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edg
 	num_nonzeroes += delaunay_cons.size() * nonzeroes_per_delaunay;
 
 	// === Build system
+	// every block of rows has a fixed place in rhs and nz, so the blocks are filled in parallel
 	VectorXd rhs(num_rows);
 	typedef Triplet<double> Nonzero;
-	vector<Nonzero> nz;
-	nz.reserve(num_nonzeroes);
-	int current_row = 0;
+	vector<Nonzero> nz(num_nonzeroes);
+	// two rows that pull b - a towards (dx, dy)
+	auto set_difference_rows = [&](int row, int first_nonzero, Vertex* a, Vertex* b, double weight, double dx, double dy) {
+		nz[first_nonzero] = Nonzero(row, x_id(a->id), -weight);
+		nz[first_nonzero + 1] = Nonzero(row, x_id(b->id), weight);
+		rhs[row] = weight * dx;
+		nz[first_nonzero + 2] = Nonzero(row + 1, y_id(a->id), -weight);
+		nz[first_nonzero + 3] = Nonzero(row + 1, y_id(b->id), weight);
+		rhs[row + 1] = weight * dy;
+	};
+	int first_row = 0;
+	int first_nonzero = 0;
 	// position
-	for (Vertex* v : vertices) {
-		nz.emplace_back(current_row, x_id(v->id), position_weight);
-		rhs[current_row] = position_weight * v->original.x;
-		++current_row;
-		nz.emplace_back(current_row, y_id(v->id), position_weight);
-		rhs[current_row] = position_weight * v->original.y;
-		++current_row;
-	}
+	parallel_for(0, vertices.size(), [&](size_t i) {
+		Vertex* v = vertices[i];
+		int row = first_row + rows_per_vertex * i;
+		int k = first_nonzero + nonzeroes_per_vertex * i;
+		nz[k] = Nonzero(row, x_id(v->id), position_weight);
+		rhs[row] = position_weight * v->original.x;
+		nz[k + 1] = Nonzero(row + 1, y_id(v->id), position_weight);
+		rhs[row + 1] = position_weight * v->original.y;
+	});
+	first_row += rows_per_vertex * vertices.size();
+	first_nonzero += nonzeroes_per_vertex * vertices.size();
 	// edge
-	for (Edge* e : edges) {
-		double dx = e->b->original.x - e->a->original.x;
-		double dy = e->b->original.y - e->a->original.y;
+	parallel_for(0, edges.size(), [&](size_t i) {
+		Edge* e = edges[i];
+		double dx = e->b->current.x - e->a->current.x;
+		double dy = e->b->current.y - e->a->current.y;
 		if (enlarge_short_edges) {
 			double length = std::sqrt(dx * dx + dy * dy);
 			if (length < edge_min_length) {
@@ -146,70 +187,114 @@ void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edg
 				dy *= edge_min_length / length;
 			}
 		}
-		nz.emplace_back(current_row, x_id(e->a->id), -edge_weight);
-		nz.emplace_back(current_row, x_id(e->b->id), edge_weight);
-		rhs[current_row] = edge_weight * dx;
-		++current_row;
-		nz.emplace_back(current_row, y_id(e->a->id), -edge_weight);
-		nz.emplace_back(current_row, y_id(e->b->id), edge_weight);
-		rhs[current_row] = edge_weight * dy;
-		++current_row;
-	}
+		set_difference_rows(first_row + rows_per_edge * i, first_nonzero + nonzeroes_per_edge * i, e->a, e->b, edge_weight, dx, dy);
+	});
+	first_row += rows_per_edge * edges.size();
+	first_nonzero += nonzeroes_per_edge * edges.size();
 	// too near
-	for (auto [a, b] : too_near) {
-		double dx = b->original.x - a->original.x;
-		double dy = b->original.y - a->original.y;
+	parallel_for(0, too_near.size(), [&](size_t i) {
+		auto [a, b] = too_near[i];
+		double dx = b->current.x - a->current.x;
+		double dy = b->current.y - a->current.y;
 		double length = std::sqrt(dx * dx + dy * dy);
 		dx *= too_near_distance / length;
 		dy *= too_near_distance / length;
-		nz.emplace_back(current_row, x_id(a->id), -too_near_weight);
-		nz.emplace_back(current_row, x_id(b->id), too_near_weight);
-		rhs[current_row] = too_near_weight * dx;
-		++current_row;
-		nz.emplace_back(current_row, y_id(a->id), -too_near_weight);
-		nz.emplace_back(current_row, y_id(b->id), too_near_weight);
-		rhs[current_row] = too_near_weight * dy;
-		++current_row;
-	}
+		set_difference_rows(first_row + rows_per_too_near * i, first_nonzero + nonzeroes_per_too_near * i, a, b, too_near_weight, dx, dy);
+	});
+	first_row += rows_per_too_near * too_near.size();
+	first_nonzero += nonzeroes_per_too_near * too_near.size();
 	// delaunay
-	for (auto [a, b] : delaunay_cons) {
-		double dx = b->original.x - a->original.x;
-		double dy = b->original.y - a->original.y;
+	parallel_for(0, delaunay_cons.size(), [&](size_t i) {
+		auto [a, b] = delaunay_cons[i];
+		double dx = b->current.x - a->current.x;
+		double dy = b->current.y - a->current.y;
 		double length = std::sqrt(dx * dx + dy * dy);
 		dx *= delaunay_min_length / length;
 		dy *= delaunay_min_length / length;
-		nz.emplace_back(current_row, x_id(a->id), -delaunay_weight);
-		nz.emplace_back(current_row, x_id(b->id), delaunay_weight);
-		rhs[current_row] = delaunay_weight * dx;
-		++current_row;
-		nz.emplace_back(current_row, y_id(a->id), -delaunay_weight);
-		nz.emplace_back(current_row, y_id(b->id), delaunay_weight);
-		rhs[current_row] = delaunay_weight * dy;
-		++current_row;
-	}
+		set_difference_rows(first_row + rows_per_delaunay * i, first_nonzero + nonzeroes_per_delaunay * i, a, b, delaunay_weight, dx, dy);
+	});
 
 	// === Solve
 	SparseMatrix<double> A(num_rows, num_vars);
 	A.setFromTriplets(nz.begin(), nz.end());
 
-	SparseMatrix<double> AtA = A.transpose() * A;
-	VectorXd Atb = A.transpose() * rhs;
-	SimplicialLDLT<SparseMatrix<double>> solver(AtA);
-	VectorXd x = solver.solve(Atb);
+	Timer solve_time;
+	VectorXd x;
+	const double megabyte = 1024.0 * 1024.0;
+	const size_t bytes_per_nonzero = sizeof(double) + sizeof(SparseMatrix<double>::StorageIndex);
+	if (settings.solver == CartogramSolver::LSCG) {
+		// warm start from the positions this pass starts from; the original ones in the first pass
+		VectorXd guess(num_vars);
+		for (Vertex* v : vertices) {
+			guess[x_id(v->id)] = v->current.x;
+			guess[y_id(v->id)] = v->current.y;
+		}
+		LeastSquaresConjugateGradient<SparseMatrix<double>> solver;
+		solver.setTolerance(settings.tolerance);
+		solver.compute(A);
+		x = solver.solveWithGuess(rhs, guess);
+		console->info("Cartogram LSCG: {} iterations, estimated error {:.3e}, {:.1f} MB matrix, {:.3f} seconds",
+			solver.iterations(), solver.error(), A.nonZeros() * bytes_per_nonzero / megabyte, solve_time.elapsed().count());
+	}
+	else {
+		// the too-near and Delaunay pairs change every pass, so the symbolic analysis is redone too
+		SparseMatrix<double> AtA = A.transpose() * A;
+		VectorXd Atb = A.transpose() * rhs;
+		SimplicialLDLT<SparseMatrix<double>> solver(AtA);
+		x = solver.solve(Atb);
+		console->info("Cartogram LDLT: {:.1f} MB normal matrix, {:.1f} MB factor, {:.3f} seconds",
+			AtA.nonZeros() * bytes_per_nonzero / megabyte, solver.matrixL().nestedExpression().nonZeros() * bytes_per_nonzero / megabyte, solve_time.elapsed().count());
+	}
 	//VectorXd discrep = A * x - rhs;
 
 	// === Read out solution and put it into the Vertices
-	for (Vertex* v : vertices) {
-		v->current.x = x[x_id(v->id)];
-		v->current.y = x[y_id(v->id)];
+	set_vertices_from_eigen(vertices, start, x, 1.0);
+	BinnedGeometry geom_checker;
+	if (check_valid_full(vertices, edges, geom_checker)) {
+		console->info("Accepting cartogram at time 1");
+		return true;
 	}
-	// back off if result is not topogically valid
-	double t = 1.0;
-	while (!check_valid_full(vertices, edges)) {
-		t -= 0.1;
+	// back off: bisect for the largest valid t, assuming the start (t = 0) is valid
+	double valid_t = 0.0;
+	double invalid_t = 1.0;
+	while (invalid_t - valid_t > settings.resolution) {
+		double t = (valid_t + invalid_t) / 2;
 		console->info("Checking cartogram at time {}", t);
-		set_vertices_from_eigen(vertices, x, t);
+		set_vertices_from_eigen(vertices, start, x, t);
+		if (check_valid_full(vertices, edges, geom_checker)) valid_t = t;
+		else invalid_t = t;
+	}
+	// try to keep the full cartogram everywhere except at the vertices involved in violations
+	vector<double> vertex_t(vertices.size(), 1.0);
+	const int max_fallback_rounds = 10;
+	for (int round = 0; round < max_fallback_rounds; ++round) {
+		set_vertices_from_eigen(vertices, start, x, vertex_t);
+		vector<Vertex*> violating = geom_checker.collect_violations(vertices, edges);
+		if (violating.empty()) {
+			int num_backed_off = std::count(vertex_t.begin(), vertex_t.end(), valid_t);
+			console->info("Accepting cartogram at time 1 except for {} vertices at time {}", num_backed_off, valid_t);
+			return true;
+		}
+		bool changed = false;
+		for (Vertex* v : violating) {
+			if (vertex_t[v->id] != valid_t) {
+				vertex_t[v->id] = valid_t;
+				changed = true;
+			}
+		}
+		if (!changed) break;
+	}
+	set_vertices_from_eigen(vertices, start, x, valid_t);
+	if (valid_t == 0.0 && !check_valid_full(vertices, edges, geom_checker)) {
+		console->error("Cartogram input is not a valid drawing; no back-off can make it valid.");
 	}
-	console->info("Accepting cartogram at time {}", t);
+	console->info("Accepting cartogram at time {}", valid_t);
+	return valid_t > 0.0;
+}
 
-}
\ No newline at end of file
+void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges, const CartogramSettings& settings) {
+	for (int pass = 1; pass <= settings.iterations; ++pass) {
+		if (settings.iterations > 1) console->info("Cartogram pass {} of {}", pass, settings.iterations);
+		if (!cartogram_pass(vertices, edges, settings)) break;
+	}
+}
@@ -6,6 +6,21 @@
 class Vertex;
 class Edge;
 
-void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges, bool enlarge_short_edges, bool space_nearby_vertices, bool add_cdt);
+enum class CartogramSolver {
+	LDLT, // factorise the normal equations A^T A directly
+	LSCG  // conjugate gradient on the least-squares problem, without forming A^T A
+};
+
+struct CartogramSettings {
+	bool enlarge_short_edges = true;
+	bool space_nearby_vertices = true;
+	bool add_cdt = true;
+	CartogramSolver solver = CartogramSolver::LDLT;
+	double tolerance = 1e-10; // relative residual for LSCG
+	double resolution = 1.0 / 64; // of the bisection on the back-off parameter t
+	int iterations = 1; // passes, each re-deriving the constraints from the previous result
+};
+
+void apply_cartogram(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges, const CartogramSettings& settings);
 
 #endif //ndef INCLUDED_CARTOGRAM_PREPROCESS
\ No newline at end of file
@@ -1,9 +1,8 @@
 #include "density_annealing.h"
 
-#include <map>
+#include <algorithm>
 #include <tuple>
 #include <cmath>
-using std::map;
 using std::tuple;
 using std::vector;
 
@@ -21,36 +20,283 @@ double evaluate_density(const vector<Vertex*>& vertices) {
 	return score;
 }
 
+double evaluate_grid_density(const std::vector<Vertex*>& vertices) {
+	GridDensityCost cost(vertices);
+	return cost.evaluate();
+}
+
+double evaluate_rounding_cost(const vector<Vertex*>& vertices) {
+	double score = 0;
+	for (Vertex* v : vertices) score += v->rounding_cost();
+	return score;
+}
+
+double ContinuousDensityCost::delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to) {
+	// as in evaluate_density, a vertex only carries the density of pairs with higher id
+	double change = 0;
+	double own_density = 0;
+	for (Vertex* u : vertices) {
+		if (u == v) continue;
+		double before = 1.0 / distance_sqr(u->current, from);
+		double after = 1.0 / distance_sqr(u->current, to);
+		if (u->id < v->id) u->density += after - before;
+		else own_density += after;
+		change += after - before;
+	}
+	v->density = own_density;
+	changes.touch_all();
+	return change;
+}
+
+double CutoffDensityCost::evaluate() {
+	const double radius_sqr = radius * radius;
+	changes.touch_all();
+	grid.clear();
+	for (Vertex* v : vertices) grid.insert(v, v->current);
+	double score = 0;
+	for (Vertex* v : vertices) {
+		double local_density = 0;
+		grid.for_each_near(v->current, radius, [&](Vertex* u) {
+			double d = distance_sqr(u->current, v->current);
+			if (u != v && d < radius_sqr) local_density += 1.0 / d;
+		});
+		v->density = local_density;
+		score += local_density;
+	}
+	return score / 2; // every pair was counted at both ends
+}
+
+double CutoffDensityCost::delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to) {
+	const double radius_sqr = radius * radius;
+	double change = 0;
+	grid.remove(v, from);
+	grid.for_each_near(from, radius, [&](Vertex* u) {
+		double d = distance_sqr(u->current, from);
+		if (d < radius_sqr) {
+			u->density = std::max(0.0, u->density - 1.0 / d); // no negative weights from rounding errors
+			change -= 1.0 / d;
+			changes.touch(u);
+		}
+	});
+	double own_density = 0;
+	grid.for_each_near(to, radius, [&](Vertex* u) {
+		double d = distance_sqr(u->current, to);
+		if (d < radius_sqr) {
+			u->density += 1.0 / d;
+			own_density += 1.0 / d;
+			changes.touch(u);
+		}
+	});
+	grid.insert(v, to);
+	v->density = own_density;
+	changes.touch(v);
+	return change + own_density;
+}
+
+double BarnesHutDensityCost::refresh_densities() {
+	double score = 0;
+	for (Vertex* v : vertices) {
+		v->density = tree.density_at(v->current, v);
+		score += v->density;
+	}
+	moves_since_refresh = 0;
+	changes.touch_all();
+	return score / 2; // every pair was counted at both ends
+}
+
+double BarnesHutDensityCost::evaluate() {
+	tree.build(vertices);
+	double score = refresh_densities();
+	report_error();
+	return score;
+}
+
+void BarnesHutDensityCost::report_error() const {
+	// compare against the exact sum when that is affordable
+	const size_t max_exact_vertices = 2000;
+	if (vertices.size() > max_exact_vertices) return;
+	double exact_total = 0;
+	double approx_total = 0;
+	double max_relative_error = 0;
+	for (Vertex* v : vertices) {
+		double exact = 0;
+		for (Vertex* u : vertices) {
+			if (u != v) exact += 1.0 / distance_sqr(u, v);
+		}
+		exact_total += exact;
+		approx_total += v->density;
+		if (exact > 0) max_relative_error = std::max(max_relative_error, std::abs(v->density - exact) / exact);
+	}
+	console->info("Barnes-Hut density error: total {:.3e} relative, worst vertex {:.3e} relative", std::abs(approx_total - exact_total) / exact_total, max_relative_error);
+}
+
+double BarnesHutDensityCost::delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to) {
+	double before = tree.density_at(from, v);
+	tree.move(v, from, to);
+	double after = tree.density_at(to, v);
+	v->density = after;
+	changes.touch(v);
+	if (++moves_since_refresh >= vertices.size()) refresh_densities();
+	return after - before;
+}
+
 constexpr tuple<int, int> make_entry(double x, double y) {
 	return { static_cast<int>(std::round(x)), static_cast<int>(std::round(y)) };
 }
 
-double evaluate_grid_density(const std::vector<Vertex*>& vertices) {
-	map<tuple<int, int>, double> density;
+void GridDensityCost::reset_table(size_t capacity) {
+	size_t size = 16;
+	while (size < capacity) size *= 2;
+	table.assign(size, Cell{ empty_key, 0, 0, -1 });
+	num_cells = 0;
+}
+
+void GridDensityCost::reserve(size_t extra_cells) {
+	// keep the load factor at most 1/2
+	if (2 * (num_cells + extra_cells) <= table.size()) return;
+	vector<Cell> old_table;
+	old_table.swap(table);
+	reset_table(4 * (num_cells + extra_cells));
+	for (const Cell& cell : old_table) {
+		if (cell.key == empty_key) continue;
+		size_t mask = table.size() - 1;
+		size_t i = (cell.key * 0x9E3779B97F4A7C15ull >> 17) & mask;
+		while (table[i].key != empty_key) i = (i + 1) & mask;
+		table[i] = cell;
+		++num_cells;
+	}
+}
+
+int GridDensityCost::find_or_insert(int x, int y) {
+	uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+	size_t mask = table.size() - 1;
+	size_t i = (key * 0x9E3779B97F4A7C15ull >> 17) & mask;
+	while (table[i].key != key) {
+		if (table[i].key == empty_key) {
+			table[i].key = key;
+			++num_cells;
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return static_cast<int>(i);
+}
+
+void GridDensityCost::add_footprint(const Vertex::Point& p, int sign) {
+	if (is_grid_point(p)) {
+		const int weight = 4; // 1/9
+		for (int x = p.x - 1; x <= p.x + 1; ++x) {
+			for (int y = p.y - 1; y <= p.y + 1; ++y) {
+				table[find_or_insert(x, y)].weight += sign * weight;
+			}
+		}
+	}
+	else {
+		const int weight = 9; // 1/4
+		auto [x0, y0] = make_entry(std::floor(p.x), std::floor(p.y));
+		auto [x1, y1] = make_entry(std::ceil(p.x), std::ceil(p.y));
+		table[find_or_insert(x0, y0)].weight += sign * weight;
+		table[find_or_insert(x1, y0)].weight += sign * weight;
+		table[find_or_insert(x0, y1)].weight += sign * weight;
+		table[find_or_insert(x1, y1)].weight += sign * weight;
+	}
+}
+
+void GridDensityCost::link(Vertex* v, int cell) {
+	Cell& c = table[cell];
+	next_occupant[v->id] = c.first_occupant;
+	previous_occupant[v->id] = -1;
+	if (c.first_occupant >= 0) previous_occupant[c.first_occupant] = v->id;
+	c.first_occupant = v->id;
+	++c.num_occupants;
+}
+
+void GridDensityCost::unlink(Vertex* v, int cell) {
+	Cell& c = table[cell];
+	int next = next_occupant[v->id];
+	int previous = previous_occupant[v->id];
+	if (previous >= 0) next_occupant[previous] = next;
+	else c.first_occupant = next;
+	if (next >= 0) previous_occupant[next] = previous;
+	--c.num_occupants;
+}
+
+void GridDensityCost::update_densities(const Cell& cell) {
+	int here = cell.weight / 36;
+	for (int u = cell.first_occupant; u >= 0; u = next_occupant[u]) {
+		vertices[u]->density = here * here;
+		changes.touch(vertices[u]);
+	}
+}
+
+double GridDensityCost::cell_score(const Cell& cell) const {
+	int here = cell.weight / 36;
+	return static_cast<double>(cell.num_occupants) * here * here;
+}
+
+double GridDensityCost::evaluate() {
+	changes.touch_all();
+	// a footprint covers at most 9 cells, but neighbouring footprints mostly overlap
+	reset_table(8 * vertices.size());
+	next_occupant.assign(vertices.size(), -1);
+	previous_occupant.assign(vertices.size(), -1);
 	for (Vertex* v : vertices) {
-		if (v->is_rounded) {
-			const double weight = 1.0 / 9.0;
-			for (int x = v->current.x - 1; x <= v->current.x + 1; ++x) {
-				for (int y = v->current.y - 1; y <= v->current.y + 1; ++y) {
-					density[{x, y}] += weight;
-				}
+		reserve(10);
+		add_footprint(v->current, 1);
+		auto [x, y] = make_entry(v->current.x, v->current.y);
+		link(v, find_or_insert(x, y));
+	}
+	double score = 0;
+	for (const Cell& cell : table) {
+		if (cell.key == empty_key) continue;
+		update_densities(cell);
+		score += cell_score(cell);
+	}
+	return score;
+}
+
+double GridDensityCost::delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to) {
+	// make sure the table does not grow while we hold cell indices
+	reserve(20);
+
+	// collect the cells whose weight or occupants can change
+	int affected[20];
+	int num_affected = 0;
+	auto touch = [&](int x, int y) {
+		int cell = find_or_insert(x, y);
+		if (std::find(affected, affected + num_affected, cell) == affected + num_affected) affected[num_affected++] = cell;
+		return cell;
+	};
+	int from_cell = std::apply(touch, make_entry(from.x, from.y));
+	int to_cell = std::apply(touch, make_entry(to.x, to.y));
+	for (const Vertex::Point& p : { from, to }) {
+		if (is_grid_point(p)) {
+			for (int x = p.x - 1; x <= p.x + 1; ++x) {
+				for (int y = p.y - 1; y <= p.y + 1; ++y) touch(x, y);
 			}
 		}
 		else {
-			const double weight = 1.0 / 4.0;
-			density[make_entry(std::floor(v->current.x), std::floor(v->current.y))] += weight;
-			density[make_entry(std::ceil(v->current.x), std::floor(v->current.y))] += weight;
-			density[make_entry(std::floor(v->current.x), std::ceil(v->current.y))] += weight;
-			density[make_entry(std::ceil(v->current.x), std::ceil(v->current.y))] += weight;
+			auto [x0, y0] = make_entry(std::floor(p.x), std::floor(p.y));
+			auto [x1, y1] = make_entry(std::ceil(p.x), std::ceil(p.y));
+			touch(x0, y0);
+			touch(x1, y0);
+			touch(x0, y1);
+			touch(x1, y1);
 		}
 	}
-	double score = 0;
-	for (Vertex* v : vertices) {
-		double local_density = 0;
-		int here = density[make_entry(v->current.x, v->current.y)];
-		local_density += here * here;
-		v->density = local_density;
-		score += local_density;
+
+	double before = 0;
+	for (int i = 0; i < num_affected; ++i) before += cell_score(table[affected[i]]);
+
+	add_footprint(from, -1);
+	add_footprint(to, 1);
+	unlink(v, from_cell);
+	link(v, to_cell);
+
+	double after = 0;
+	for (int i = 0; i < num_affected; ++i) {
+		update_densities(table[affected[i]]);
+		after += cell_score(table[affected[i]]);
 	}
-	return score;
+	return after - before;
 }
@@ -1,23 +1,182 @@
 #ifndef INCLUDED_DENSITY_ANNEALING
 #define INCLUDED_DENSITY_ANNEALING
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include <limits>
-#include <functional>
+#include <cmath>
 #include "Vertex.h"
 #include "Edge.h"
 #include "Logging.h"
 #include "annealing_help.h"
 #include "geometry_help.h"
+#include "BinnedGeometry.h"
 #include "LinearProgress.h"
 #include "Checkpoint.h"
+#include "AnnealingStats.h"
+#include "snapshot.h"
+#include "VertexGrid.h"
+#include "DensityQuadtree.h"
+#include "WeightedSampler.h"
 
 double evaluate_density(const std::vector<Vertex*>& vertices);
 double evaluate_grid_density(const std::vector<Vertex*>& vertices);
 double evaluate_rounding_cost(const std::vector<Vertex*>& vertices);
 
-template<typename RNG>
-void density_annealing(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges, std::function<double()> evaluate_score, RNG& rng) {
+// Cost policies for density_annealing.
+// evaluate() computes the score from scratch (and sets the density of every vertex).
+// delta(v, from, to) is called after v has moved from `from` to `to`; it returns the
+// change in score and updates cached state as if the move is kept. A move is undone
+// by calling delta again with the positions swapped.
+// Both record in `changes` which density fields they modified.
+
+// Vertices whose density field changed since the annealer last looked.
+struct DensityChanges {
+	bool all = false;
+	std::vector<Vertex*> vertices;
+	void touch(Vertex* v) { if (!all) vertices.push_back(v); }
+	void touch_all() { all = true; vertices.clear(); }
+	void clear() { all = false; vertices.clear(); }
+};
+
+class ContinuousDensityCost {
+public:
+	ContinuousDensityCost(const std::vector<Vertex*>& vertices) : vertices(vertices) {}
+	double evaluate() { changes.touch_all(); return evaluate_density(vertices); }
+	double delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to);
+	DensityChanges changes;
+private:
+	const std::vector<Vertex*>& vertices;
+};
+
+// Continuous density restricted to pairs closer than a cutoff radius, found through a VertexGrid.
+// Unlike evaluate_density, every vertex carries the density of all of its pairs, so a move
+// only touches the vertices near its old and new position.
+class CutoffDensityCost {
+public:
+	CutoffDensityCost(const std::vector<Vertex*>& vertices, double radius) : vertices(vertices), radius(radius), grid(radius) {}
+	double evaluate();
+	double delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to);
+	DensityChanges changes;
+private:
+	const std::vector<Vertex*>& vertices;
+	double radius;
+	VertexGrid grid;
+};
+
+// Continuous density over all pairs, approximated by Barnes-Hut with opening angle theta.
+// Each vertex carries the density of all of its pairs. A move updates the density of the
+// moved vertex only; the others are refreshed after every V moves.
+class BarnesHutDensityCost {
+public:
+	BarnesHutDensityCost(const std::vector<Vertex*>& vertices, double theta) : vertices(vertices), tree(theta) {}
+	double evaluate();
+	double delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to);
+	DensityChanges changes;
+private:
+	const std::vector<Vertex*>& vertices;
+	DensityQuadtree tree;
+	size_t moves_since_refresh = 0;
+
+	double refresh_densities();
+	void report_error() const;
+};
+
+class GridDensityCost {
+public:
+	GridDensityCost(const std::vector<Vertex*>& vertices) : vertices(vertices) {}
+	double evaluate();
+	double delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to);
+	DensityChanges changes;
+private:
+	// Open-addressing table of grid cells, kept across moves; cells are never removed.
+	// Weights are kept in units of 1/36 so that adding and removing footprints is exact.
+	// The vertices rounding to a cell form a linked list through next/previous_occupant.
+	struct Cell {
+		uint64_t key;
+		int weight;
+		int num_occupants;
+		int first_occupant;
+	};
+	static constexpr uint64_t empty_key = uint64_t(1) << 63; // cell (INT_MIN, 0), never used
+	const std::vector<Vertex*>& vertices;
+	std::vector<Cell> table;
+	size_t num_cells = 0;
+	std::vector<int> next_occupant;
+	std::vector<int> previous_occupant;
+
+	void reset_table(size_t capacity);
+	void reserve(size_t extra_cells);
+	int find_or_insert(int x, int y);
+	void add_footprint(const Vertex::Point& p, int sign);
+	void link(Vertex* v, int cell);
+	void unlink(Vertex* v, int cell);
+	void update_densities(const Cell& cell);
+	double cell_score(const Cell& cell) const;
+};
+
+class RoundingCost {
+public:
+	RoundingCost(const std::vector<Vertex*>& vertices) : vertices(vertices) {}
+	double evaluate() { return evaluate_rounding_cost(vertices); }
+	double delta(Vertex* v, const Vertex::Point& from, const Vertex::Point& to) {
+		return std::sqrt(distance_sqr(to, v->original)) - std::sqrt(distance_sqr(from, v->original));
+	}
+	DensityChanges changes; // rounding cost does not use densities
+private:
+	const std::vector<Vertex*>& vertices;
+};
+
+// Picks the vertex to move in density_annealing, proportional to its density, with unrounded
+// vertices ten times as likely. The second view leaves out rounded vertices entirely.
+// An unrounded vertex weighs at least as much as one with a single neighbour ten units away,
+// so vertices without nearby neighbours (or without densities at all) still get moved.
+class DensitySampler {
+public:
+	DensitySampler(const std::vector<Vertex*>& vertices) : vertices(vertices) {
+		all.assign(vertices.size());
+		unrounded.assign(vertices.size());
+	}
+	void update(Vertex* v) {
+		all.set(v->id, weight(v));
+		unrounded.set(v->id, v->is_rounded ? 0 : weight(v));
+	}
+	void update(DensityChanges& changes) {
+		if (changes.all) {
+			for (Vertex* v : vertices) {
+				all.set_leaf(v->id, weight(v));
+				unrounded.set_leaf(v->id, v->is_rounded ? 0 : weight(v));
+			}
+			all.rebuild();
+			unrounded.rebuild();
+		}
+		else {
+			for (Vertex* v : changes.vertices) update(v);
+		}
+		changes.clear();
+	}
+	// The unrounded view has weight exactly when some vertex is unrounded; it is never drawn from
+	// while empty, since the sum tree would then fall back on all vertices, rounded ones included.
+	template<typename RNG>
+	Vertex* sample(bool only_unrounded, RNG& rng) const {
+		if (only_unrounded && unrounded.total() > 0) return vertices[unrounded.sample(rng)];
+		return vertices[all.sample(rng)];
+	}
+private:
+	const std::vector<Vertex*>& vertices;
+	WeightedSampler all;
+	WeightedSampler unrounded;
+	static constexpr double min_unrounded_density = 0.01;
+	static double weight(const Vertex* v) {
+		double density = std::max(0.0, v->density); // incremental updates can leave a tiny negative
+		return v->is_rounded ? density : 10 * std::max(density, min_unrounded_density);
+	}
+};
+
+template<typename Cost, typename RNG>
+void density_annealing(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges, Cost& cost, RNG& rng, AnnealingStats& stats,
+	SnapshotWriter& snapshots, const AnnealingSnapshot* resume = nullptr, int repair_radius = 0) {
 	int max_iterations = std::numeric_limits<int>::max();
 	double temperature = 1.0;
 	double cooling = 1.0;
@@ -30,61 +189,102 @@ void density_annealing(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges
 		return;
 	}
 
-	double score = evaluate_score();
+	double score = cost.evaluate();
 	int iteration = 0;
+	if (resume != nullptr) {
+		// the score continues as it was accumulated; the densities, sampler weights and dirty flags are
+		// rebuilt from the positions (see AnnealingSnapshot on what that means for exactness)
+		score = resume->score;
+		iteration = resume->iteration;
+		temperature = resume->temperature;
+		cooling = resume->cooling;
+	}
 	console->info("================== Annealing for feasibility.");
 	LinearProgress progress_report("Annealing ", "iterations", 0);
+	progress_report.attach(stats);
 	progress_report.start();
 
-	std::vector<double> vertex_weights(vertices.size());
+	DensitySampler sampler(vertices);
+	sampler.update(cost.changes);
+	GeometryBins bins(vertices, edges);
+	BinnedGeometry geom_checker;
+
+	// A failed greedy attempt can only succeed later if a committed move came near one of its
+	// candidate stars. The candidates lie within candidate_margin of the vertex (one unit for greedy,
+	// a bit further for repair), so those stars stay within that margin of the current star: only
+	// unrounded vertices near the move, or with an edge passing near it, need another attempt.
+	const double candidate_margin = repair_radius > 0 ? std::max(1.0, repair_radius + 0.5) : 1.0;
+	std::vector<char> dirty(vertices.size(), 1);
+	std::vector<Vertex*> near_vertices;
+	std::vector<Edge*> near_edges;
+	auto mark_dirty = [&](Vertex* v, const Vertex::Point& from) {
+		Box reach = star_box(v);
+		reach.add(from);
+		reach = { reach.x0 - candidate_margin, reach.y0 - candidate_margin, reach.x1 + candidate_margin, reach.y1 + candidate_margin };
+		bins.gather(reach.x0, reach.y0, reach.x1, reach.y1, near_vertices, near_edges);
+		for (Vertex* u : near_vertices) {
+			if (!u->is_rounded && reach.intersects(Box{ u->current.x, u->current.y, u->current.x, u->current.y })) dirty[u->id] = 1;
+		}
+		for (Edge* e : near_edges) {
+			Box box{ e->a->current.x, e->a->current.y, e->a->current.x, e->a->current.y };
+			box.add(e->b->current);
+			if (!box.intersects(reach)) continue;
+			if (!e->a->is_rounded) dirty[e->a->id] = 1;
+			if (!e->b->is_rounded) dirty[e->b->id] = 1;
+		}
+	};
 
 	while (iteration < max_iterations) {
 		progress_report.tick(num_rounded);
+		if (snapshots.due()) {
+			snapshots.write(AnnealingSnapshot::feasibility, iteration, temperature, cooling, score, rng, vertices, edges.size(), stats);
+		}
 		++iteration;
+		stats.iteration();
 		temperature *= cooling;
-		// attempt greedy on each unrounded vertex
-		bool greedy_changed_something = false;
+		// attempt greedy on each unrounded vertex whose neighbourhood changed
 		for (Vertex* v : vertices) {
-			if (!v->is_rounded) {
-				if (attempt_greedy(v, vertices, edges)) {
+			if (!v->is_rounded && dirty[v->id]) {
+				dirty[v->id] = 0;
+				Vertex::Point from = v->current;
+				// optionally fall back on a wider search around the current position
+				if (attempt_greedy(v, bins) || (repair_radius > 0 && attempt_spiral(v, from, repair_radius, bins))) {
 					++num_rounded;
-					greedy_changed_something = true;
+					score += cost.delta(v, from, v->current);
+					sampler.update(cost.changes);
+					sampler.update(v);
+					mark_dirty(v, from);
 				}
 			}
 		}
-		if (greedy_changed_something) {
-			score = evaluate_score();
-		}
 		// we are done if all vertices are feasible
 		if (num_rounded == vertices.size()) {
 			progress_report.done(num_rounded);
 			console->info("================== Found feasible drawing by greedy after {} iterations.", iteration);
 			return;
 		}
-		// pick random vertex
-		for (Vertex* v : vertices) {
-			vertex_weights[v->id] = v->density;
-			if (!v->is_rounded) {
-				vertex_weights[v->id] *= 10;
-			}
-			else if (iteration % 2 == 1) vertex_weights[v->id] = 0;
-		}
-		std::discrete_distribution<> vertex_distribution(vertex_weights.begin(), vertex_weights.end());
-		Vertex* v = vertices[vertex_distribution(rng)];
+		// pick random vertex; every other iteration only unrounded ones
+		Vertex* v = sampler.sample(iteration % 2 == 1, rng);
 
 		// mutate current solution, but be able to undo it.
+		Vertex::Point from = v->current;
 		Checkpoint checkpoint(v->current);
 		v->mutate(rng);
 
-		if (check_valid_after_move(v, vertices, edges)) {
-			double new_score = evaluate_score();
+		MoveCheck check = check_valid_after_move(v, vertices, edges, geom_checker);
+		stats.record(check);
+		if (check == MoveCheck::Valid) {
+			double new_score = score + cost.delta(v, from, v->current);
 			bool was_already_rounded = v->is_rounded;
 			v->set_rounded_state();
 			if (!was_already_rounded && v->is_rounded) {
 				// always accept if we round a vertex
+				stats.record_forced();
 				++num_rounded;
 				score = new_score;
 				checkpoint.commit();
+				bins.moved(v, from);
+				mark_dirty(v, from);
 				if (num_rounded == vertices.size()) {
 					progress_report.done(num_rounded);
 					console->info("Found feasible drawing in {} iterations.", iteration);
@@ -93,15 +293,22 @@ void density_annealing(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges
 			}
 			else {
 				// "annealing" decision whether to accept move
-				if (accept_move(temperature, score, new_score, rng)) {
+				bool accept = accept_move(temperature, score, new_score, rng);
+				stats.record_decision(accept);
+				if (accept) {
 					score = new_score;
 					checkpoint.commit();
+					bins.moved(v, from);
+					mark_dirty(v, from);
 				}
 				else {
 					// rejected annealing step
 					// checkpoint will reset vertex
+					cost.delta(v, v->current, from);
 				}
 			}
+			sampler.update(cost.changes);
+			sampler.update(v);
 		}
 	}
 	progress_report.done(num_rounded);
@@ -1,10 +1,23 @@
 #include "geometry_help.h"
 #include "BinnedGeometry.h"
 
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+
+#define CGAL_HEADER_ONLY 1
+#include "CGAL/intersections.h"
+#include "CGAL/Exact_predicates_inexact_constructions_kernel.h"
+using Kernel = CGAL::Exact_predicates_inexact_constructions_kernel;
+using Point = Kernel::Point_2;
+using Segment = Kernel::Segment_2;
+
+using std::pair;
 using std::vector;
 
 #include "Vertex.h"
 #include "Checkpoint.h"
+#include "Edge.h"
 
 vector<Vertex::Point> backup_vertices(const vector<Vertex*>& vertices) {
 	vector<Vertex::Point> result;
@@ -15,51 +28,169 @@ vector<Vertex::Point> backup_vertices(const vector<Vertex*>& vertices) {
 	return result;
 }
 
-bool attempt_move(Vertex* v, double x, double y, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges) {
-	Checkpoint attempt(v->current);
-	v->current.x = x;
-	v->current.y = y;
-	if (check_valid_after_move(v, vertices, edges)) {
-		v->set_rounded_state();
-		attempt.commit();
-		return true;
+void Box::add(const Vertex::Point& p) {
+	x0 = std::min(x0, p.x);
+	y0 = std::min(y0, p.y);
+	x1 = std::max(x1, p.x);
+	y1 = std::max(y1, p.y);
+}
+
+Box star_box(Vertex* v, double margin) {
+	Box box{ v->current.x - margin, v->current.y - margin, v->current.x + margin, v->current.y + margin };
+	for (Edge* e : v->N) box.add(e->other(v)->current);
+	return box;
+}
+
+GraphCopy::GraphCopy(const vector<Vertex*>& original_vertices, const vector<Edge*>& original_edges) {
+	vertices.reserve(original_vertices.size());
+	for (Vertex* v : original_vertices) {
+		Vertex* copy = new Vertex(*v);
+		copy->N.clear();
+		vertices.push_back(copy);
 	}
-	return false;
+	// relies on vertices[i]->id == i; the order of N is the rotation system and is kept
+	edges.reserve(original_edges.size());
+	std::unordered_map<Edge*, Edge*> edge_copies;
+	for (Edge* e : original_edges) {
+		Edge* copy = new Edge(vertices[e->a->id], vertices[e->b->id]);
+		copy->angle = e->angle;
+		edges.push_back(copy);
+		edge_copies[e] = copy;
+	}
+	for (Vertex* v : original_vertices) {
+		for (Edge* e : v->N) vertices[v->id]->N.push_back(edge_copies[e]);
+	}
+}
+
+GraphCopy::~GraphCopy() {
+	for (Edge* e : edges) delete e;
+	for (Vertex* v : vertices) delete v;
 }
-bool attempt_greedy(Vertex* v, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges) {
-	// rounding is cheapest
-	if (attempt_move(v, std::round(v->current.x), std::round(v->current.y), vertices, edges)) return true;
-	// try grid-adjacent positions
-	double dx = std::abs(v->current.x - std::round(v->current.x));
-	double dy = std::abs(v->current.y - std::round(v->current.y));
+
+// Moves v to the first valid candidate, if any.
+bool attempt_candidates(Vertex* v, const Vertex::Point* candidates, int num_candidates, GeometryBins& bins) {
+	std::uint64_t valid = check_candidates(v, candidates, num_candidates, bins);
+	if (valid == 0) return false;
+	int first = 0;
+	while (!(valid & (std::uint64_t(1) << first))) ++first;
+	Vertex::Point from = v->current;
+	v->current = candidates[first];
+	v->set_rounded_state();
+	bins.moved(v, from);
+	return true;
+}
+
+bool attempt_greedy(Vertex* v, GeometryBins& bins) {
+	double x = v->current.x;
+	double y = v->current.y;
+	// rounding is cheapest, then grid-adjacent positions, then the diagonal grid point
+	Vertex::Point candidates[4];
+	candidates[0] = { std::round(x), std::round(y) };
+	double dx = std::abs(x - std::round(x));
+	double dy = std::abs(y - std::round(y));
 	if (dx >= dy) {
-		if (attempt_move(v, round_away(v->current.x), std::round(v->current.y), vertices, edges)) return true;
-		if (attempt_move(v, std::round(v->current.x), round_away(v->current.y), vertices, edges)) return true;
+		candidates[1] = { round_away(x), std::round(y) };
+		candidates[2] = { std::round(x), round_away(y) };
 	}
 	else {
-		if (attempt_move(v, std::round(v->current.x), round_away(v->current.y), vertices, edges)) return true;
-		if (attempt_move(v, round_away(v->current.x), std::round(v->current.y), vertices, edges)) return true;
+		candidates[1] = { std::round(x), round_away(y) };
+		candidates[2] = { round_away(x), std::round(y) };
 	}
-	// try diagonal grid point
-	return attempt_move(v, round_away(v->current.x), round_away(v->current.y), vertices, edges);
+	candidates[3] = { round_away(x), round_away(y) };
+	return attempt_candidates(v, candidates, 4, bins);
+}
+
+bool attempt_spiral(Vertex* v, const Vertex::Point& target, int radius, GeometryBins& bins) {
+	// Rings around the rounded position, ordered by distance to target. That distance is a lower
+	// bound on the cost of everything after it, so the first valid candidate is the cheapest and
+	// the rest need no validity check.
+	double cx = std::round(v->current.x);
+	double cy = std::round(v->current.y);
+	vector<pair<double, Vertex::Point>> candidates;
+	candidates.reserve((2 * radius + 1) * (2 * radius + 1));
+	for (int ring = 0; ring <= radius; ++ring) {
+		for (int dx = -ring; dx <= ring; ++dx) {
+			for (int dy = -ring; dy <= ring; ++dy) {
+				if (std::max(std::abs(dx), std::abs(dy)) != ring) continue;
+				Vertex::Point p{ cx + dx, cy + dy };
+				candidates.push_back({ distance_sqr(p, target), p });
+			}
+		}
+	}
+	std::stable_sort(candidates.begin(), candidates.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	vector<Vertex::Point> batch;
+	for (size_t i = 0; i < candidates.size(); i += max_candidates) {
+		batch.clear();
+		for (size_t j = i; j < std::min(candidates.size(), i + max_candidates); ++j) batch.push_back(candidates[j].second);
+		if (attempt_candidates(v, batch.data(), static_cast<int>(batch.size()), bins)) return true;
+	}
+	return false;
+}
+
+std::uint64_t check_candidates(Vertex* v, const Vertex::Point* candidates, int num_candidates, const GeometryBins& bins) {
+	// gather what any candidate star can meet: rounded vertices and other edges in its region
+	Box region = star_box(v);
+	for (int i = 0; i < num_candidates; ++i) region.add(candidates[i]);
+	vector<Vertex*> near_vertices;
+	vector<Edge*> near_edges;
+	bins.gather(region.x0, region.y0, region.x1, region.y1, near_vertices, near_edges);
+	vector<Vertex::Point> occupied;
+	for (Vertex* u : near_vertices) {
+		if (u->is_rounded && u != v && region.intersects(Box{ u->current.x, u->current.y, u->current.x, u->current.y })) occupied.push_back(u->current);
+	}
+	vector<pair<Edge*, Segment>> nearby;
+	for (Edge* e : near_edges) {
+		if (e->a == v || e->b == v) continue;
+		Box box{ e->a->current.x, e->a->current.y, e->a->current.x, e->a->current.y };
+		box.add(e->b->current);
+		if (box.intersects(region)) nearby.push_back({ e, Segment(Point(e->a->current.x, e->a->current.y), Point(e->b->current.x, e->b->current.y)) });
+	}
+
+	Checkpoint<Vertex::Point> restore(v->current);
+	std::uint64_t valid = 0;
+	for (int i = 0; i < num_candidates; ++i) {
+		const Vertex::Point& p = candidates[i];
+		if (std::any_of(occupied.begin(), occupied.end(), [&](const Vertex::Point& q) { return q.x == p.x && q.y == p.y; })) continue;
+		v->current = p;
+		if (!v->neighborhood_rotsys_valid()) continue;
+		bool crossing = false;
+		for (Edge* e : v->N) {
+			Vertex* n = e->other(v);
+			Segment seg(Point(p.x, p.y), Point(n->current.x, n->current.y));
+			for (const auto& [f, seg2] : nearby) {
+				if (f->a == n || f->b == n) continue;
+				if (intersection(seg, seg2)) {
+					crossing = true;
+					break;
+				}
+			}
+			if (crossing) break;
+		}
+		if (!crossing) valid |= std::uint64_t(1) << i;
+	}
+	return valid;
 }
 
 bool check_valid_full(const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
 	BinnedGeometry geom_checker;
+	return check_valid_full(vertices, edges, geom_checker);
+}
+
+bool check_valid_full(const vector<Vertex*>& vertices, const vector<Edge*>& edges, BinnedGeometry& geom_checker) {
+	if (!geom_checker.overlapping_vertices(vertices).empty()) return false;
 	for (Vertex* v : vertices) {
-		if (!geom_checker.check_vertex_overlap(vertices, v)) return false;
 		if (!v->rotsys_valid()) return false;
 	}
 	if (!geom_checker.check_intersections(vertices, edges)) return false;
 	return true;
 }
 
-bool check_valid_after_move(Vertex* v, const vector<Vertex*>& vertices, const vector<Edge*>& edges) {
-	BinnedGeometry geom_checker;
-	if (!geom_checker.check_vertex_overlap(vertices, v)) return false;
-	if (!v->rotsys_valid()) return false;
+MoveCheck check_valid_after_move(Vertex* v, const vector<Vertex*>& vertices, const vector<Edge*>& edges, BinnedGeometry& geom_checker) {
+	if (!geom_checker.check_vertex_overlap(vertices, v)) return MoveCheck::VertexOverlap;
+	if (!v->rotsys_valid()) return MoveCheck::RotationAtVertex;
 	for (Edge* e : v->N) {
-		if (!e->other(v)->rotsys_valid()) return false;
+		if (!e->other(v)->rotsys_valid()) return MoveCheck::RotationAtNeighbor;
 	}
-	return geom_checker.check_intersections(vertices, edges);
+	if (!geom_checker.check_intersections(vertices, edges)) return MoveCheck::SegmentCrossing;
+	return MoveCheck::Valid;
 }
\ No newline at end of file
@@ -1,20 +1,73 @@
 #ifndef INCLUDED_GEOMETRY_HELP
 #define INCLUDED_GEOMETRY_HELP
 
+#include <cstdint>
 #include <vector>
 #include "Vertex.h"
 class Edge;
+class GeometryBins;
+struct BinnedGeometry;
 
 std::vector<Vertex::Point> backup_vertices(const std::vector<Vertex*>& vertices);
 
+// Deep copy of a graph, including ids and rotation systems, that owns its vertices and edges.
+struct GraphCopy {
+	GraphCopy(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+	~GraphCopy();
+	GraphCopy(const GraphCopy&) = delete;
+	GraphCopy& operator=(const GraphCopy&) = delete;
+	std::vector<Vertex*> vertices;
+	std::vector<Edge*> edges;
+};
+
 template<typename T >
 T round_away(T x) {
 	if (x < std::round(x)) return std::floor(x); else return std::ceil(x);
 }
 
-bool attempt_greedy(Vertex* v, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+// Axis-aligned bounding box, closed on all sides.
+struct Box {
+	double x0, y0, x1, y1;
+	void add(const Vertex::Point& p);
+	bool intersects(const Box& other) const {
+		return x0 <= other.x1 && other.x0 <= x1 && y0 <= other.y1 && other.y0 <= y1;
+	}
+};
+
+// Box around v (widened by margin) and its neighbours: everything a move of v within the margin
+// can touch, since the drawing is valid before and only v's edges and rotations are affected.
+Box star_box(Vertex* v, double margin = 0);
+
+// The attempts below keep bins up to date when they move v.
+bool attempt_greedy(Vertex* v, GeometryBins& bins);
+
+// Moves v to the valid grid point closest to target among those within the given (square) radius
+// around v's rounded position; false if there is none.
+bool attempt_spiral(Vertex* v, const Vertex::Point& target, int radius, GeometryBins& bins);
+
+// Result of check_valid_after_move: either valid, or the first reason the move failed.
+enum class MoveCheck {
+	Valid,
+	VertexOverlap,
+	RotationAtVertex,
+	RotationAtNeighbor,
+	SegmentCrossing
+};
+constexpr int num_move_checks = 5;
+
+// Bit i is set if moving v to candidates[i] keeps the drawing valid. The drawing must be valid
+// before the move; then only the overlap, rotation and crossing tests involving v's new star are
+// needed, against rounded vertices and edges gathered once from the bins around all candidates.
+constexpr int max_candidates = 64;
+std::uint64_t check_candidates(Vertex* v, const Vertex::Point* candidates, int num_candidates, const GeometryBins& bins);
 
+// A drawing is valid if no vertex lies exactly on a rounded vertex other than itself (unrounded
+// vertices may coincide with each other), every rotation system is intact and no two edges
+// without a common endpoint intersect. BinnedGeometry::collect_violations reports exactly the
+// vertices that break this; both find overlaps with BinnedGeometry::overlapping_vertices.
+// The overloads taking a BinnedGeometry reuse its bins; pass one in when checking repeatedly.
 bool check_valid_full(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
-bool check_valid_after_move(Vertex* v, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges);
+bool check_valid_full(const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges, BinnedGeometry& geom_checker);
+MoveCheck check_valid_after_move(Vertex* v, const std::vector<Vertex*>& vertices, const std::vector<Edge*>& edges, BinnedGeometry& geom_checker);
 
 #endif //ndef INCLUDED_GEOMETRY_HELP
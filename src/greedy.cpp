@@ -1,54 +1,159 @@
 #include "Greedy.h"
 
+#include <algorithm>
+#include <functional>
+using std::function;
 using std::vector;
 
 #include "Vertex.h"
 #include "Edge.h"
 #include "geometry_help.h"
+#include "BinnedGeometry.h"
+#include "scale_search.h"
+#include "VertexGrid.h"
 
 #include "Logging.h"
 
-void scale_and_greedy(vector<Vertex*>& vertices, vector<Edge*>& edges) {
-	console->info("Running scale-and-greedy...");
-	double factor = 0.0;
-	bool done = false;
-	while (!done) {
-		factor += 1.0;
-		console->info("Scale-and-greedy trying factor {}...", factor);
-		// scale everybody
-		for (Vertex* v : vertices) {
-			v->current.x = factor * v->original.x;
-			v->current.y = factor * v->original.y;
+namespace {
+
+bool greedy_at_factor(vector<Vertex*>& vertices, vector<Edge*>& edges, double factor, const function<bool()>& cancelled) {
+	// scale everybody
+	for (Vertex* v : vertices) {
+		v->current.x = factor * v->original.x;
+		v->current.y = factor * v->original.y;
+		v->set_rounded_state(); // no flags left over from an earlier trial
+	}
+	// round vertices one by one
+	GeometryBins bins(vertices, edges);
+	for (Vertex* v : vertices) {
+		if (cancelled()) return false;
+		if (!attempt_greedy(v, bins)) return false;
+	}
+	return true;
+}
+
+// Rounds the hardest vertices first: most other vertices within two units, then highest degree.
+// Vertices that fail go to a retry queue, which is worked through again as long as it shrinks.
+bool ordered_greedy_at_factor(vector<Vertex*>& vertices, vector<Edge*>& edges, double factor) {
+	const double crowd_radius = 2;
+	VertexGrid grid(crowd_radius);
+	for (Vertex* v : vertices) {
+		v->current.x = factor * v->original.x;
+		v->current.y = factor * v->original.y;
+		v->set_rounded_state();
+		grid.insert(v, v->current);
+	}
+	vector<int> crowd(vertices.size(), 0);
+	for (Vertex* v : vertices) {
+		grid.for_each_near(v->current, crowd_radius, [&](Vertex* u) {
+			if (u != v && distance_sqr(u, v) <= crowd_radius * crowd_radius) ++crowd[v->id];
+		});
+	}
+	vector<Vertex*> queue(vertices);
+	std::stable_sort(queue.begin(), queue.end(), [&](Vertex* a, Vertex* b) {
+		if (crowd[a->id] != crowd[b->id]) return crowd[a->id] > crowd[b->id];
+		return a->N.size() > b->N.size();
+	});
+
+	GeometryBins bins(vertices, edges);
+	vector<Vertex*> retry;
+	while (!queue.empty()) {
+		retry.clear();
+		for (Vertex* v : queue) {
+			if (!attempt_greedy(v, bins)) retry.push_back(v);
 		}
-		// round vertices one by one
-		done = true; // provisionally think we're done
-		for (Vertex* v : vertices) {
-			if (!attempt_greedy(v, vertices, edges)) {
-				done = false;
-				break;
-			}
+		if (retry.size() == queue.size()) {
+			console->info("Ordered greedy left {} vertices unrounded at factor {}.", retry.size(), factor);
+			return false;
 		}
+		queue.swap(retry);
+	}
+	return true;
+}
+
+bool spiral_at_factor(vector<Vertex*>& vertices, vector<Edge*>& edges, double factor, int radius) {
+	for (Vertex* v : vertices) {
+		v->current.x = factor * v->original.x;
+		v->current.y = factor * v->original.y;
+		v->set_rounded_state();
+	}
+	GeometryBins bins(vertices, edges);
+	for (Vertex* v : vertices) {
+		Vertex::Point target = v->current;
+		if (!attempt_spiral(v, target, radius, bins)) return false;
+	}
+	return true;
+}
+
+bool round_at_factor(vector<Vertex*>& vertices, vector<Edge*>& edges, double factor) {
+	// scale and round
+	for (Vertex* v : vertices) {
+		v->current.x = std::round(factor * v->original.x);
+		v->current.y = std::round(factor * v->original.y);
+	}
+	return check_valid_full(vertices, edges);
+}
+
+}
+
+void scale_and_greedy(vector<Vertex*>& vertices, vector<Edge*>& edges, double resolution, int num_threads) {
+	console->info("Running scale-and-greedy...");
+	auto never = []() { return false; };
+	if (num_threads > 1) {
+		probe_scale_factors([&](double factor, const function<bool()>& cancelled, DrawingState& drawing) {
+			GraphCopy copy(vertices, edges);
+			bool ok = greedy_at_factor(copy.vertices, copy.edges, factor, cancelled);
+			if (ok) drawing.save(copy.vertices);
+			return ok;
+		}, vertices, resolution, num_threads, "Scale-and-greedy");
+	}
+	else {
+		search_scale_factor([&](double factor) {
+			return greedy_at_factor(vertices, edges, factor, never);
+		}, vertices, resolution, "Scale-and-greedy");
 	}
 	for (Vertex* v : vertices) {
 		v->is_rounded = true;
 	}
 	console->info("Scale-and-greedy successful.");
 }
-void scale_and_round(vector<Vertex*>& vertices, vector<Edge*>& edges) {
+void scale_and_round(vector<Vertex*>& vertices, vector<Edge*>& edges, double resolution, int num_threads) {
 	console->info("Running scale-and-round...");
-	double factor = 0.0;
-	while (true) {
-		factor += 1.0;
-		console->info("Scale-and-round trying factor {}...", factor);
-		// scale and round
-		for (Vertex* v : vertices) {
-			v->current.x = std::round(factor * v->original.x);
-			v->current.y = std::round(factor * v->original.y);
-		}
-		if (check_valid_full(vertices, edges)) break;
+	if (num_threads > 1) {
+		probe_scale_factors([&](double factor, const function<bool()>&, DrawingState& drawing) {
+			GraphCopy copy(vertices, edges);
+			bool ok = round_at_factor(copy.vertices, copy.edges, factor);
+			if (ok) drawing.save(copy.vertices);
+			return ok;
+		}, vertices, resolution, num_threads, "Scale-and-round");
+	}
+	else {
+		search_scale_factor([&](double factor) {
+			return round_at_factor(vertices, edges, factor);
+		}, vertices, resolution, "Scale-and-round");
 	}
 	for (Vertex* v : vertices) {
 		v->is_rounded = true;
 	}
 	console->info("Scale-and-round successful.");
-}
\ No newline at end of file
+}
+void scale_and_ordered_greedy(vector<Vertex*>& vertices, vector<Edge*>& edges, double resolution) {
+	console->info("Running ordered scale-and-greedy...");
+	search_scale_factor([&](double factor) {
+		return ordered_greedy_at_factor(vertices, edges, factor);
+	}, vertices, resolution, "Ordered scale-and-greedy");
+	for (Vertex* v : vertices) {
+		v->is_rounded = true;
+	}
+	console->info("Ordered scale-and-greedy successful.");
+}
+void scale_and_spiral(vector<Vertex*>& vertices, vector<Edge*>& edges, int radius, double resolution) {
+	console->info("Running scale-and-spiral with radius {}...", radius);
+	search_scale_factor([&](double factor) {
+		return spiral_at_factor(vertices, edges, factor, radius);
+	}, vertices, resolution, "Scale-and-spiral");
+	for (Vertex* v : vertices) {
+		v->is_rounded = true;
+	}
+	console->info("Scale-and-spiral successful.");
+}
@@ -5,7 +5,11 @@
 class Vertex;
 class Edge;
 
-void scale_and_greedy(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
-void scale_and_round(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
+void scale_and_greedy(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges, double resolution = 1, int num_threads = 1);
+// As scale_and_greedy, but hardest vertices first and failed vertices retried before scaling up.
+void scale_and_ordered_greedy(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges, double resolution = 1);
+// As scale_and_greedy, but each vertex takes the nearest valid grid point within the radius.
+void scale_and_spiral(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges, int radius, double resolution = 1);
+void scale_and_round(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges, double resolution = 1, int num_threads = 1);
 
 #endif //ndef INCLUDED_GREEDY
\ No newline at end of file
@@ -2,13 +2,15 @@
 using std::string;
 using std::vector;
 
-#include <map>
-using std::map;
-using std::make_pair;
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 
 #include <limits>
 using std::numeric_limits;
 
+#include <thread>
+
 #include "shapefil.h"
 
 #include "Vertex.h"
@@ -29,14 +31,104 @@ Edge* make_edge(Vertex* p, Vertex* q) {
 	return e;
 }
 
-bool load_shapefile(const string& filename, vector<Vertex*>& vertices, vector<Edge*>& edges) {
+namespace {
+
+// Open-addressing table from the exact bits of a point's coordinates to a vertex id.
+// -0.0 is stored as 0.0, so the two are one point, as they compare equal.
+class PointTable {
+public:
+	// Returns the id stored for (x, y), or stores and returns new_id if the point is new.
+	int find_or_insert(double x, double y, int new_id) {
+		if (2 * (num_points + 1) > slots.size()) grow();
+		uint64_t kx = key(x), ky = key(y);
+		size_t mask = slots.size() - 1;
+		size_t i = hash(kx, ky) & mask;
+		while (slots[i].id >= 0) {
+			if (slots[i].x == kx && slots[i].y == ky) return slots[i].id;
+			i = (i + 1) & mask;
+		}
+		slots[i] = Slot{ kx, ky, new_id };
+		++num_points;
+		return new_id;
+	}
+
+private:
+	struct Slot {
+		uint64_t x, y;
+		int id;
+	};
+	vector<Slot> slots;
+	size_t num_points = 0;
+
+	static uint64_t key(double c) {
+		if (c == 0) c = 0; // -0.0
+		uint64_t bits;
+		std::memcpy(&bits, &c, sizeof(bits));
+		return bits;
+	}
+	static size_t hash(uint64_t x, uint64_t y) {
+		// coordinates often have all-zero low mantissa bits, so mix everything into the low bits
+		uint64_t h = x ^ (y + 0x9E3779B97F4A7C15ull + (x << 6) + (x >> 2));
+		h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+		h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+		return static_cast<size_t>(h ^ (h >> 31));
+	}
+	void grow() {
+		vector<Slot> old_slots;
+		old_slots.swap(slots);
+		slots.assign(std::max<size_t>(16, 2 * old_slots.size()), Slot{ 0, 0, -1 });
+		size_t mask = slots.size() - 1;
+		for (const Slot& slot : old_slots) {
+			if (slot.id < 0) continue;
+			size_t i = hash(slot.x, slot.y) & mask;
+			while (slots[i].id >= 0) i = (i + 1) & mask;
+			slots[i] = slot;
+		}
+	}
+};
+
+// The entities of a contiguous range, decoded on their own: every distinct point once,
+// in order of first occurrence, and every entity as a stroke of indices into those points.
+struct EntityRange {
+	vector<double> xs, ys;
+	vector<int> stroke_points;
+	vector<size_t> stroke_ends; // one past the last stroke point of each entity
+	bool ok = true;
+};
+
+// Reads entities [first, last) through a handle of its own, so ranges can be read concurrently.
+void read_entities(const string& filename, int first, int last, EntityRange& range) {
+	SHPHandle handle = SHPOpen(filename.c_str(), "rb");
+	if (handle == 0) {
+		range.ok = false;
+		return;
+	}
+	PointTable point_table;
+	for (int i = first; i < last; ++i) {
+		SHPObject* s = SHPReadObject(handle, i);
+		if (s != nullptr) {
+			for (int j = 0; j < s->nVertices; ++j) {
+				int new_id = static_cast<int>(range.xs.size());
+				int id = point_table.find_or_insert(s->padfX[j], s->padfY[j], new_id);
+				if (id == new_id) {
+					range.xs.push_back(s->padfX[j]);
+					range.ys.push_back(s->padfY[j]);
+				}
+				range.stroke_points.push_back(id);
+			}
+			SHPDestroyObject(s);
+		}
+		range.stroke_ends.push_back(range.stroke_points.size());
+	}
+	SHPClose(handle);
+}
+
+}
+
+bool load_shapefile(const string& filename, vector<Vertex*>& vertices, vector<Edge*>& edges, int num_threads) {
 	console->info("Loading shapefile...");
 	Timer load_time;
 
-	typedef std::map<Vertex, Vertex*> VertexMap;
-	VertexMap vertex_map;
-
-	int num_nodes = 0, num_edges = 0;
 	SHPHandle hSHP = SHPOpen(filename.c_str(), "rb");
 	if (hSHP == 0) {
 		console->error("Shapelib failed to open '{}'", filename);
@@ -46,59 +138,64 @@ bool load_shapefile(const string& filename, vector<Vertex*>& vertices, vector<Ed
 	int num_entities, shape_type;
 	double 	min_bound[4], max_bound[4];
 	SHPGetInfo(hSHP, &num_entities, &shape_type, min_bound, max_bound);
-
-	int num_hits = 0;
-	int num_entries = 0;
-	int num_zero_segments_skipped = 0;
+	SHPClose(hSHP);
 
 	console->info("numEntities: {}", num_entities);
-	for (int i = 0; i < num_entities; ++i) {
-		SHPObject* s = SHPReadObject(hSHP, i);
-
-		Vertex* previous_point_on_this_stroke = 0;
-		for (int j = 0; j < s->nVertices; ++j) {
-			++num_entries;
-			double x = s->padfX[j];
-			double y = s->padfY[j];
-			Vertex p(x, y);
-			VertexMap::iterator existing_point = vertex_map.find(p);
-			Vertex* current_point = 0;
-			if (existing_point == vertex_map.end()) {
-				// point didn't exist yet
-				current_point = new Vertex(x, y);
-				current_point->id = vertices.size();
-				vertices.push_back(current_point);
-				vertex_map.insert(make_pair(*current_point, current_point));
-				++num_nodes;
 
-			}
-			else {
-				// existing point
-				current_point = existing_point->second;
-				++num_hits;
-			}
+	// decode contiguous ranges of entities, one per thread
+	int num_ranges = std::max(1, std::min(num_threads, num_entities));
+	vector<EntityRange> ranges(num_ranges);
+	auto range_begin = [&](int r) { return static_cast<int>(static_cast<long long>(num_entities) * r / num_ranges); };
+	if (num_ranges == 1) {
+		read_entities(filename, 0, num_entities, ranges[0]);
+	}
+	else {
+		vector<std::thread> threads;
+		for (int r = 0; r < num_ranges; ++r) {
+			threads.emplace_back(read_entities, std::cref(filename), range_begin(r), range_begin(r + 1), std::ref(ranges[r]));
+		}
+		for (std::thread& t : threads) t.join();
+	}
 
-			if (previous_point_on_this_stroke == current_point) {
-				++num_zero_segments_skipped;
-				continue;
+	// merge the ranges in file order, so ids are assigned by first occurrence as in a single pass
+	PointTable point_table;
+	for (EntityRange& range : ranges) {
+		if (!range.ok) {
+			console->error("Shapelib failed to open '{}'", filename);
+			return false;
+		}
+		vector<Vertex*> range_points(range.xs.size());
+		for (size_t k = 0; k < range.xs.size(); ++k) {
+			int new_id = static_cast<int>(vertices.size());
+			int id = point_table.find_or_insert(range.xs[k], range.ys[k], new_id);
+			if (id == new_id) {
+				// point didn't exist yet
+				Vertex* v = new Vertex(range.xs[k], range.ys[k]);
+				v->id = id;
+				vertices.push_back(v);
 			}
+			range_points[k] = vertices[id];
+		}
 
-			if (previous_point_on_this_stroke) {
-				Edge* e = make_edge(current_point, previous_point_on_this_stroke);
-				if (e != nullptr) edges.push_back(e);
-				++num_edges;
+		size_t stroke_begin = 0;
+		for (size_t stroke_end : range.stroke_ends) {
+			Vertex* previous_point_on_this_stroke = 0;
+			for (size_t k = stroke_begin; k < stroke_end; ++k) {
+				Vertex* current_point = range_points[range.stroke_points[k]];
+				if (previous_point_on_this_stroke == current_point) continue; // zero-length segment
+				if (previous_point_on_this_stroke) {
+					Edge* e = make_edge(current_point, previous_point_on_this_stroke);
+					if (e != nullptr) edges.push_back(e);
+				}
+				previous_point_on_this_stroke = current_point;
 			}
-			previous_point_on_this_stroke = current_point;
-
+			stroke_begin = stroke_end;
 		}
-
-		SHPDestroyObject(s);
-
+		range = EntityRange(); // release the decoded range
 	}
 	console->info("Number of points: {}", vertices.size());
 	console->info("Number of edges: {}", edges.size());
-	SHPClose(hSHP);
 
-	console->info("Loading time = {} s.", load_time.elapsed().count());
+	console->info("Loading time = {} s on {} threads.", load_time.elapsed().count(), num_ranges);
 	return true;
-}
\ No newline at end of file
+}
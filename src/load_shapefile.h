@@ -7,6 +7,8 @@
 class Vertex;
 class Edge;
 
-bool load_shapefile(const std::string& filename, std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
+// Reads the polylines of a shapefile; points with the same coordinates become one vertex.
+// With num_threads > 1, ranges of entities are decoded concurrently; the result is the same.
+bool load_shapefile(const std::string& filename, std::vector<Vertex*>& vertices, std::vector<Edge*>& edges, int num_threads = 1);
 
 #endif //ndef INCLUDED_LOAD_SHAPEFILE
\ No newline at end of file
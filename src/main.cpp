@@ -3,11 +3,24 @@ R"(
 Armstrong.
 Usage:
   armstrong [options] <input>
+  armstrong [options] --batch <list>
 
 Options:
    -v --verbose          Verbose output.
-   -f --feasibility=<m>  Feasibility method. One of: round, greedy, anneal, grid, none
+   -f --feasibility=<m>  Feasibility method. One of: round, greedy, ordered, spiral, snap, anneal, grid, none
+   --scale-resolution=<r>  Step between the scale factors tried by round, greedy, ordered and spiral. [default: 1]
+   --threads=<n>         Probe this many scale factors at once for round and greedy. [default: 1]
+   --load-threads=<n>    Read shapefiles on this many threads. [default: 1]
+   --spiral-radius=<r>   Search radius of spiral feasibility and of --repair. [default: 2]
+   --repair              In annealing feasibility, place vertices greedy cannot round by spiral search.
+   --density=<d>         Density for anneal feasibility. One of: exact, cutoff, barneshut [default: cutoff]
+   --cutoff=<r>          Ignore pairs further apart than this in cutoff density. [default: 5]
+   --theta=<x>           Opening angle of the barneshut density. [default: 0.5]
    --carto               Preprocess with linear cartogram
+   --carto-solver=<s>    Least-squares solver for the cartogram. One of: ldlt, lscg [default: ldlt]
+   --carto-resolution=<x>  Precision of the search for how much of the cartogram is valid. [default: 0.015625]
+   --carto-iterations=<k>  Number of cartogram passes. [default: 1]
+   --carto-tol=<x>       Relative residual at which the lscg cartogram solver stops. [default: 1e-10]
    -m --steps=<n>        Number of steps for quality annealing. [default: 10000]
    -t --temp=<x>         Initial temperature for quality annealing.
    --mintemp=<x>         Minimum temperature for quality annealing. [default: 0]
@@ -18,13 +31,23 @@ Options:
    --nocenter            Do not center the input network.
    -o --output=<file>    Output filename, otherwise to stdout.
    -d --dump             Write intermediate results to file.
+   --dump-format=<f>     Format of the intermediate results. One of: agf, agb [default: agf]
+   --convert=<file>      Only convert <input> to file (.agf or .agb) and exit.
+   --report=<file>       Write annealing telemetry (rejection reasons, accept rates) as JSON.
+   --snapshot=<file>     Periodically save the annealing state to file.
+   --snapshot-every=<s>  Seconds between snapshots. [default: 600]
+   --resume=<file>       Continue the annealing run saved in a snapshot file (approximately).
+   --batch               Process every input file listed (one per line) in <list>.
+   -j --jobs=<n>         Number of inputs processed in parallel in batch mode. [default: 1]
    -h --help             Show this screen.
 )";
 
-#include <functional>
 #include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <future>
 #include <vector>
+#include <thread>
 #include <tuple>
 #include <map>
 using namespace std;
@@ -48,22 +71,101 @@ using RandomEngine = std::mt19937;
 #include "annealing_help.h"
 #include "cartogram_preprocess.h"
 #include "Greedy.h"
+#include "snap_rounding.h"
 #include "Checkpoint.h"
 #include "Timer.h"
 #include "Logging.h"
 #include "LinearProgress.h"
+#include "AnnealingStats.h"
+#include "snapshot.h"
+
+#include <fmt/format.h>
 
 #include "load_shapefile.h"
 #include "agf_file.h"
+#include "agb_file.h"
 #include "write_svg.h"
 
 #include "density_annealing.h"
 
 
-double evaluate_rounding_cost(const vector<Vertex*>& vertices) {
-	double score = 0;
-	for (Vertex* v : vertices) score += v->rounding_cost();
-	return score;
+enum class Feasibility { Round, Greedy, Ordered, Spiral, Snap, Anneal, Grid, Cost, None };
+enum class DensityModel { Exact, Cutoff, BarnesHut };
+
+// Settings from the command line that apply to every input.
+struct Settings {
+	Feasibility feasibility_method = Feasibility::None;
+	DensityModel density_model = DensityModel::Cutoff;
+	double density_cutoff = 5;
+	double density_theta = 0.5;
+	double scale_resolution = 1;
+	int scale_threads = 1;
+	int load_threads = 1;
+	int spiral_radius = 2;
+	bool repair = false;
+	bool carto = false;
+	CartogramSettings carto_settings;
+	bool nocenter = false;
+	bool has_grid = false;
+	int grid_size = 0;
+	int max_iterations = 0;
+	double temperature = 1.0;
+	double min_temperature = 0.0;
+	double cooling = 0.99;
+	bool hillclimb = false;
+	bool dump = false;
+	string dump_extension = ".agf";
+	string report_filename;
+	string snapshot_filename;
+	double snapshot_interval = 600;
+	string resume_filename;
+};
+
+void ensure_feasible(const Settings& settings, Vertices& vertices, Edges& edges, RandomEngine& rng, AnnealingStats& stats,
+	SnapshotWriter& snapshots, const AnnealingSnapshot* resume, SnapMapping& snap_mapping) {
+	switch (settings.feasibility_method) {
+	case Feasibility::Round:
+		scale_and_round(vertices, edges, settings.scale_resolution, settings.scale_threads);
+		break;
+	case Feasibility::Greedy:
+		scale_and_greedy(vertices, edges, settings.scale_resolution, settings.scale_threads);
+		break;
+	case Feasibility::Ordered:
+		scale_and_ordered_greedy(vertices, edges, settings.scale_resolution);
+		break;
+	case Feasibility::Spiral:
+		scale_and_spiral(vertices, edges, settings.spiral_radius, settings.scale_resolution);
+		break;
+	case Feasibility::Snap:
+		snap_mapping = snap_round(vertices, edges);
+		break;
+	case Feasibility::Anneal:
+		if (settings.density_model == DensityModel::Cutoff) {
+			CutoffDensityCost cost(vertices, settings.density_cutoff);
+			density_annealing(vertices, edges, cost, rng, stats, snapshots, resume, settings.repair ? settings.spiral_radius : 0);
+		}
+		else if (settings.density_model == DensityModel::BarnesHut) {
+			BarnesHutDensityCost cost(vertices, settings.density_theta);
+			density_annealing(vertices, edges, cost, rng, stats, snapshots, resume, settings.repair ? settings.spiral_radius : 0);
+		}
+		else {
+			ContinuousDensityCost cost(vertices);
+			density_annealing(vertices, edges, cost, rng, stats, snapshots, resume, settings.repair ? settings.spiral_radius : 0);
+		}
+		break;
+	case Feasibility::Grid: {
+		GridDensityCost cost(vertices);
+		density_annealing(vertices, edges, cost, rng, stats, snapshots, resume, settings.repair ? settings.spiral_radius : 0);
+		break;
+	}
+	case Feasibility::Cost: {
+		RoundingCost cost(vertices);
+		density_annealing(vertices, edges, cost, rng, stats, snapshots, resume, settings.repair ? settings.spiral_radius : 0);
+		break;
+	}
+	case Feasibility::None:
+		break;
+	}
 }
 
 void handle_docopt_double(string_view message, double& result, const docopt::value& val) {
@@ -90,152 +192,248 @@ void handle_docopt_double(string_view message, double& result, const docopt::val
 	// Do not do anything if value is missing; this is not a warning.
 }
 
-int main(int argc, char** argv) {
-	// Parse command line arguments.
-	auto args = docopt::docopt(USAGE, { argv + 1, argv + argc }, true, "Align");
-
-	// Setup logging console and handle verbose flag.
-	console = spdlog::stderr_color_mt("main");
-	if (args["--verbose"].asBool()) console->set_level(spdlog::level::info);
-	else console->set_level(spdlog::level::err);
-
-	Vertices vertices;
-	Edges edges;
-
-	// Load and normalise input
-	string shapefile_extension = ".shp";
-	string agf_extension = ".agf";
-	string graph_filename = args["<input>"].asString();
-	if (0 == graph_filename.compare(graph_filename.length() - shapefile_extension.length(), shapefile_extension.length(), shapefile_extension)) {
-		if (!load_shapefile(graph_filename, vertices, edges)) return -1;
-	}
-	if (0 == graph_filename.compare(graph_filename.length() - agf_extension.length(), agf_extension.length(), agf_extension)) {
-		if (!load_agffile(graph_filename, vertices, edges)) return -1;
-	}
-	double min_x = numeric_limits<double>::max();
-	double min_y = numeric_limits<double>::max();
-	double max_x = numeric_limits<double>::lowest();
-	double max_y = numeric_limits<double>::lowest();
-	for (Vertex* v : vertices) {
-		min_x = std::min(min_x, v->current.x);
-		max_x = std::max(max_x, v->current.x);
-		min_y = std::min(min_y, v->current.y);
-		max_y = std::max(max_y, v->current.y);
-	}
-	double width = max_x - min_x;
-	double height = max_y - min_y;
-	double extent = std::max(width, height);
-
-	if (args["--nocenter"].asBool()) {}
-	else {
-		console->info("Centering input graph (old center was: {} {})", (width / 2) + min_x, (height / 2) + min_y);
-		for (Vertex* v : vertices) {
-			v->current.x -= (width / 2) + min_x;
-			v->current.y -= (height / 2) + min_y;
-			v->original.x -= (width / 2) + min_x;
-			v->original.y -= (height / 2) + min_y;
-		}
-	}
-
-	// rescale
-	int grid_size = static_cast<int>(extent); // integer unit grid by default 
-	if (args["--grid"]) {
-		grid_size = args["--grid"].asLong();
-		for (Vertex* v : vertices) {
-			v->current.x = (v->current.x / extent) * grid_size;
-			v->current.y = (v->current.y / extent) * grid_size;
-			v->original.x = (v->original.x / extent) * grid_size;
-			v->original.y = (v->original.y / extent) * grid_size;
-		}
-	}
-
-	// set up random source
-	std::random_device random_device;
-	RandomEngine rng(random_device());
-	std::uniform_int_distribution<std::mt19937::result_type> random_vertex(0, vertices.size() - 1);
+// Where the results for one input go; empty names are not written.
+struct Outputs {
+	string dump_filename;
+	string svg_filename;
+	string result_filename;
+};
+
+struct RunResult {
+	bool ok = false;
+	size_t num_vertices = 0;
+	double cost = 0;
+	long long feasibility_iterations = 0;
+	int quality_iterations = 0;
+	double seconds = 0;
+};
+
+Settings parse_settings(map<string, docopt::value>& args) {
+	Settings settings;
 
 	// --feasibility
-	function<void()> ensure_feasible;
 	auto feasibility_arg = args["--feasibility"];
 	if (feasibility_arg.isString()) {
 		string arg = feasibility_arg.asString();
 		if (arg == "round") {
 			console->info("Feasibility method: rounding coordinates.");
-			ensure_feasible = [&]() {
-				scale_and_round(vertices, edges);
-			};
+			settings.feasibility_method = Feasibility::Round;
 		}
 		else if (arg == "greedy") {
 			console->info("Feasibility method: greedy heuristic.");
-			ensure_feasible = [&]() {
-				scale_and_greedy(vertices, edges);
-			};
+			settings.feasibility_method = Feasibility::Greedy;
+		}
+		else if (arg == "ordered") {
+			console->info("Feasibility method: greedy heuristic, hardest vertices first.");
+			settings.feasibility_method = Feasibility::Ordered;
+		}
+		else if (arg == "spiral") {
+			console->info("Feasibility method: nearest valid grid point by spiral search.");
+			settings.feasibility_method = Feasibility::Spiral;
+		}
+		else if (arg == "snap") {
+			console->info("Feasibility method: snap rounding.");
+			settings.feasibility_method = Feasibility::Snap;
 		}
 		else if (arg == "anneal") {
 			console->info("Feasibility method: annealing with continuous density.");
-			ensure_feasible = [&]() {
-				density_annealing(vertices, edges, [&]() { return evaluate_density(vertices); }, rng);
-			};
+			settings.feasibility_method = Feasibility::Anneal;
 		}
 		else if (arg == "grid") {
 			console->info("Feasibility method: annealing with grid density.");
-			ensure_feasible = [&]() {
-				density_annealing(vertices, edges, [&]() { return evaluate_grid_density(vertices); }, rng);
-			};
+			settings.feasibility_method = Feasibility::Grid;
 		}
 		else if (arg == "cost") {
 			console->info("Feasibility method: cost.");
-			ensure_feasible = [&]() {
-				density_annealing(vertices, edges, [&]() { return evaluate_rounding_cost(vertices); }, rng);
-			};
+			settings.feasibility_method = Feasibility::Cost;
 		}
 		else if (arg == "none") {
 			console->info("Feasibility method: none. Input drawing should be feasible.");
-			ensure_feasible = []() { return; };
 		}
 		else {
 			console->error("Did not recognise '{}' as feasibility method. Will skip feasibility phase.", arg);
-			ensure_feasible = []() { return; };
 		}
 	}
 	else {
 		console->warn("No feasibility method indicated; things will be bad if input is not feasible.");
-		ensure_feasible = []() { return; };
+	}
+
+	// --scale-resolution
+	handle_docopt_double("--scale-resolution", settings.scale_resolution, args["--scale-resolution"]);
+	if (!(settings.scale_resolution > 0)) {
+		console->error("Scale resolution must be positive; using 1.");
+		settings.scale_resolution = 1;
+	}
+
+	// --threads, --load-threads
+	settings.scale_threads = std::max(1, static_cast<int>(args["--threads"].asLong()));
+	settings.load_threads = std::max(1, static_cast<int>(args["--load-threads"].asLong()));
+
+	// --spiral-radius, --repair
+	settings.spiral_radius = std::max(0, static_cast<int>(args["--spiral-radius"].asLong()));
+	settings.repair = args["--repair"].asBool();
+	if (settings.repair) console->info("Repairing stuck vertices by spiral search with radius {}.", settings.spiral_radius);
+
+	// --density, --cutoff
+	if (args["--density"].isString()) {
+		string arg = args["--density"].asString();
+		if (arg == "exact") settings.density_model = DensityModel::Exact;
+		else if (arg == "cutoff") settings.density_model = DensityModel::Cutoff;
+		else if (arg == "barneshut") settings.density_model = DensityModel::BarnesHut;
+		else console->error("Did not recognise '{}' as density model; using cutoff.", arg);
+	}
+	handle_docopt_double("--cutoff", settings.density_cutoff, args["--cutoff"]);
+	handle_docopt_double("--theta", settings.density_theta, args["--theta"]);
+	if (settings.feasibility_method == Feasibility::Anneal) {
+		if (settings.density_model == DensityModel::Cutoff) console->info("Density: pairs closer than {}.", settings.density_cutoff);
+		else if (settings.density_model == DensityModel::BarnesHut) console->info("Density: all pairs, Barnes-Hut with opening angle {}.", settings.density_theta);
+		else console->info("Density: all pairs.");
+	}
+
+	settings.carto = args["--carto"].asBool();
+	if (args["--carto-solver"].isString()) {
+		string arg = args["--carto-solver"].asString();
+		if (arg == "ldlt") settings.carto_settings.solver = CartogramSolver::LDLT;
+		else if (arg == "lscg") settings.carto_settings.solver = CartogramSolver::LSCG;
+		else console->error("Did not recognise '{}' as cartogram solver; using ldlt.", arg);
+	}
+	handle_docopt_double("--carto-tol", settings.carto_settings.tolerance, args["--carto-tol"]);
+	settings.carto_settings.iterations = std::max(1, static_cast<int>(args["--carto-iterations"].asLong()));
+	handle_docopt_double("--carto-resolution", settings.carto_settings.resolution, args["--carto-resolution"]);
+	settings.nocenter = args["--nocenter"].asBool();
+	if (args["--grid"]) {
+		settings.has_grid = true;
+		settings.grid_size = args["--grid"].asLong();
 	}
 
 	// --max-steps
-	int max_iterations = args["--steps"].asLong(); // has docopt default
+	settings.max_iterations = args["--steps"].asLong(); // has docopt default
 
 	// --temperature
-	double temperature = 1.0; // default is set here
-	handle_docopt_double("--temp", temperature, args["--temp"]);
+	handle_docopt_double("--temp", settings.temperature, args["--temp"]);
 
 	// --minimum temperature
-	double min_temperature = 0.0; // default is set here
-	handle_docopt_double("--mintemp", min_temperature, args["--mintemp"]);
+	handle_docopt_double("--mintemp", settings.min_temperature, args["--mintemp"]);
 
 	// --cooling
-	double cooling = 0.99; // default is set here
-	handle_docopt_double("--cooling", cooling, args["--cooling"]);
+	handle_docopt_double("--cooling", settings.cooling, args["--cooling"]);
 
 	if (args["--autocool"].asBool()) {
-		cooling = exponential_schedule(temperature, min_temperature, max_iterations);
-		console->info("Setting cooling schedule from {} to {} in {} steps (factor {})", temperature, min_temperature, max_iterations, cooling);
+		settings.cooling = exponential_schedule(settings.temperature, settings.min_temperature, settings.max_iterations);
+		console->info("Setting cooling schedule from {} to {} in {} steps (factor {})", settings.temperature, settings.min_temperature, settings.max_iterations, settings.cooling);
 	}
 
-	bool hillclimb = args["--hillclimb"].asBool();
-	if (hillclimb) {
+	settings.hillclimb = args["--hillclimb"].asBool();
+	if (settings.hillclimb) {
 		console->info("Postprocess hillclimbing enabled.");
 	}
 
-	// --output
-	ofstream output_file;
-	bool output_to_file = false;
-	if (args["--output"].isString()) {
-		output_to_file = true;
-		output_file.open(args["--output"].asString());
+	settings.dump = args["--dump"].asBool();
+	if (args["--dump-format"].isString()) {
+		string arg = args["--dump-format"].asString();
+		if (arg == "agf" || arg == "agb") settings.dump_extension = "." + arg;
+		else console->error("Did not recognise '{}' as dump format; using agf.", arg);
 	}
-	ostream& output = output_to_file ? output_file : std::cout;
+	if (args["--report"].isString()) settings.report_filename = args["--report"].asString();
+
+	// --snapshot, --resume
+	if (args["--snapshot"].isString()) settings.snapshot_filename = args["--snapshot"].asString();
+	handle_docopt_double("--snapshot-every", settings.snapshot_interval, args["--snapshot-every"]);
+	if (args["--resume"].isString()) settings.resume_filename = args["--resume"].asString();
+
+	return settings;
+}
+
+bool has_extension(const string& filename, const string& extension) {
+	return filename.length() >= extension.length() &&
+		0 == filename.compare(filename.length() - extension.length(), extension.length(), extension);
+}
+
+// Loads a graph in the format its extension names: .shp, .agf or .agb.
+bool load_graph(const string& filename, Vertices& vertices, Edges& edges, int load_threads) {
+	if (has_extension(filename, ".shp")) return load_shapefile(filename, vertices, edges, load_threads);
+	if (has_extension(filename, ".agf")) return load_agffile(filename, vertices, edges);
+	if (has_extension(filename, ".agb")) return load_agbfile(filename, vertices, edges);
+	console->error("Do not know how to read '{}'; expected .shp, .agf or .agb", filename);
+	return false;
+}
+
+// Writes a graph as .agb if the filename says so, otherwise as .agf; false if writing failed.
+bool write_graph(const string& filename, Vertices& vertices, Edges& edges) {
+	if (has_extension(filename, ".agb")) return write_agbfile(filename, vertices, edges);
+	return write_agffile(filename, vertices, edges);
+}
+
+RunResult run(const string& graph_filename, const Settings& settings, const Outputs& outputs) {
+	Timer run_time;
+	RunResult result;
+
+	Vertices vertices;
+	Edges edges;
+	struct Cleanup {
+		Vertices& vertices;
+		Edges& edges;
+		~Cleanup() {
+			for (Edge* e : edges) delete e;
+			for (Vertex* v : vertices) delete v;
+		}
+	} cleanup{ vertices, edges };
+	std::future<bool> dump_written; // a background dump, waited for before run reports success
+	bool outputs_written = true; // the writers log their own errors
+
+	// Load and normalise input
+	if (!load_graph(graph_filename, vertices, edges, settings.load_threads)) return result;
+	if (vertices.empty()) {
+		console->error("No vertices loaded from '{}'", graph_filename);
+		return result;
+	}
+	result.num_vertices = vertices.size();
+
+	double min_x = numeric_limits<double>::max();
+	double min_y = numeric_limits<double>::max();
+	double max_x = numeric_limits<double>::lowest();
+	double max_y = numeric_limits<double>::lowest();
+	for (Vertex* v : vertices) {
+		min_x = std::min(min_x, v->current.x);
+		max_x = std::max(max_x, v->current.x);
+		min_y = std::min(min_y, v->current.y);
+		max_y = std::max(max_y, v->current.y);
+	}
+	double width = max_x - min_x;
+	double height = max_y - min_y;
+	double extent = std::max(width, height);
+
+	if (settings.nocenter) {}
+	else {
+		console->info("Centering input graph (old center was: {} {})", (width / 2) + min_x, (height / 2) + min_y);
+		for (Vertex* v : vertices) {
+			v->current.x -= (width / 2) + min_x;
+			v->current.y -= (height / 2) + min_y;
+			v->original.x -= (width / 2) + min_x;
+			v->original.y -= (height / 2) + min_y;
+		}
+	}
+
+	// rescale
+	int grid_size = static_cast<int>(extent); // integer unit grid by default 
+	if (settings.has_grid) {
+		grid_size = settings.grid_size;
+		for (Vertex* v : vertices) {
+			v->current.x = (v->current.x / extent) * grid_size;
+			v->current.y = (v->current.y / extent) * grid_size;
+			v->original.x = (v->original.x / extent) * grid_size;
+			v->original.y = (v->original.y / extent) * grid_size;
+		}
+	}
+
+	// set up random source
+	std::random_device random_device;
+	RandomEngine rng(random_device());
+
+	double temperature = settings.temperature;
+	double min_temperature = settings.min_temperature;
+	double cooling = settings.cooling;
+	int max_iterations = settings.max_iterations;
 
 	// === Check input. ===
 
@@ -260,25 +458,68 @@ int main(int argc, char** argv) {
 
 	// === Work. ===
 
+	// --snapshot, --resume
+	SnapshotWriter snapshots(settings.snapshot_filename, settings.snapshot_interval);
+	AnnealingSnapshot resume;
+	bool resuming = false;
+	if (!settings.resume_filename.empty()) {
+		if (!read_snapshot(settings.resume_filename, resume)) return result;
+		if (settings.feasibility_method == Feasibility::Snap) {
+			console->error("Cannot resume a snap-rounded run: snap rounding changes the graph");
+			return result;
+		}
+		if (resume.method != static_cast<int>(settings.feasibility_method)) {
+			console->error("Snapshot '{}' was made with a different feasibility method (-f)", settings.resume_filename);
+			return result;
+		}
+		if (!resume.restore_positions(vertices, edges.size())) return result;
+		resume.restore_rng(rng);
+		resuming = true;
+		console->info("Resuming {} annealing from '{}' at iteration {}", resume.phase == AnnealingSnapshot::quality ? "quality" : "feasibility", settings.resume_filename, resume.iteration);
+	}
+	bool resume_quality = resuming && resume.phase == AnnealingSnapshot::quality;
+
 	// apply linear cartogram preprocessing?
-	if (args["--carto"].asBool()) {
+	if (resuming) {}
+	else if (settings.carto) {
 		console->info("Applying linear cartogram...");
-		apply_cartogram(vertices, edges, true, true, true);
+		apply_cartogram(vertices, edges, settings.carto_settings);
 		if (!check_valid_full(vertices, edges)) {
 			console->error("Drawing no longer valid after cartogram. Things are going to be bad.");
 		}
 	}
-	auto positions_after_preprocessing = backup_vertices(vertices);
+	auto positions_after_preprocessing = resuming ? resume.preprocessed : backup_vertices(vertices);
+	snapshots.carried.method = static_cast<int>(settings.feasibility_method);
+	snapshots.carried.preprocessed = positions_after_preprocessing;
 
 	// turn input graph into SOME grid drawing
-	ensure_feasible();
-	auto positions_first_feasible = backup_vertices(vertices);
+	AnnealingStats feasibility_stats("feasibility");
+	if (resuming) feasibility_stats = resume.feasibility_stats;
+	if (!resume_quality) {
+		Timer feasibility_time;
+		SnapMapping snap_mapping;
+		ensure_feasible(settings, vertices, edges, rng, feasibility_stats, snapshots, resuming ? &resume : nullptr, snap_mapping);
+		console->info("Feasibility phase took {:.3f} seconds.", feasibility_time.elapsed().count());
+		if (!snap_mapping.input_vertex.empty()) {
+			// snap rounding merged vertices; keep the earlier positions of the remaining ones
+			vector<Vertex::Point> remaining;
+			remaining.reserve(vertices.size());
+			for (int i : snap_mapping.input_vertex) remaining.push_back(positions_after_preprocessing[i]);
+			positions_after_preprocessing.swap(remaining);
+			snapshots.carried.preprocessed = positions_after_preprocessing;
+		}
+	}
+	auto positions_first_feasible = resume_quality ? resume.first_feasible : backup_vertices(vertices);
+	snapshots.carried.first_feasible = positions_first_feasible;
+	snapshots.carried.feasibility_stats = feasibility_stats;
 	{
 		double score = evaluate_rounding_cost(vertices);
 		console->info("Average cost per vertex: {}", score / vertices.size());
 	}
-	if (args["--dump"].asBool()) {
-		write_agffile("feasible.agf", vertices, edges);
+	if (settings.dump && !outputs.dump_filename.empty()) {
+		// formatting text takes a while, so agf dumps are written while the pipeline goes on
+		if (has_extension(outputs.dump_filename, ".agf")) dump_written = write_agffile_async(outputs.dump_filename, vertices, edges);
+		else outputs_written = write_graph(outputs.dump_filename, vertices, edges);
 	}
 
 	// sanity check: is the "ensured feasible" drawing actually valid?
@@ -293,16 +534,32 @@ int main(int argc, char** argv) {
 	}
 
 	// anneal for quality
-	double score = evaluate_rounding_cost(vertices);
+	RoundingCost rounding_cost(vertices);
+	double score = rounding_cost.evaluate();
 	int annealing_iteration = 0;
+	if (resume_quality) {
+		annealing_iteration = resume.iteration;
+		temperature = resume.temperature;
+		cooling = resume.cooling;
+		score = resume.score;
+	}
 	console->info("================== Annealing for quality.");
 	LinearProgress progress_report("Annealing ", "iterations", max_iterations);
+	AnnealingStats quality_stats("quality");
+	if (resume_quality) quality_stats = resume.quality_stats;
+	progress_report.attach(quality_stats);
 	progress_report.start();
 	int recent_rejections = 0;
 	vector<int> vertex_weights(vertices.size());
+	// set up only now: snap rounding can change the number of vertices
+	std::uniform_int_distribution<std::mt19937::result_type> random_vertex(0, vertices.size() - 1);
 	while (annealing_iteration < max_iterations) {
 		progress_report.tick(score);
+		if (snapshots.due()) {
+			snapshots.write(AnnealingSnapshot::quality, annealing_iteration, temperature, cooling, score, rng, vertices, edges.size(), quality_stats);
+		}
 		++annealing_iteration;
+		quality_stats.iteration();
 		temperature *= cooling;
 
 		// if temperature drops below threshold, disable cooling.
@@ -316,13 +573,18 @@ int main(int argc, char** argv) {
 		Vertex* v = vertices[random_vertex(rng)];
 
 		// mutate current solution, but be able to undo it.
+		Vertex::Point from = v->current;
 		Checkpoint checkpoint(v->current);
 		v->mutate(rng);
 
-		if (check_valid_after_move(v, vertices, edges)) {
+		MoveCheck check = check_valid_after_move(v, vertices, edges, geom_checker);
+		quality_stats.record(check);
+		if (check == MoveCheck::Valid) {
 			// "annealing" decision whether to accept move
-			double new_score = evaluate_rounding_cost(vertices);
-			if (accept_move(temperature, score, new_score, rng)) {
+			double new_score = score + rounding_cost.delta(v, from, v->current);
+			bool accept = accept_move(temperature, score, new_score, rng);
+			quality_stats.record_decision(accept);
+			if (accept) {
 				score = new_score;
 				checkpoint.commit();
 				recent_rejections = 0;
@@ -342,17 +604,18 @@ int main(int argc, char** argv) {
 	console->info("Average cost per vertex: {}", score / vertices.size());
 
 	// hillclimb to local optimum
-	if (hillclimb) {
+	if (settings.hillclimb) {
 		console->info("================== Hillclimbing for quality.");
 		LinearProgress climbing_progress("Hillclimbing ", "rounds", 0);
 		int climb_iteration = 0;
 		bool changed = false;
+		GeometryBins bins(vertices, edges);
 		do {
 			climbing_progress.tick(0);
 			++climb_iteration;
 			changed = false;
 			for (Vertex* v : vertices) {
-				while (v->climb(vertices, edges)) { changed = true; }
+				while (v->climb(bins)) { changed = true; }
 			}
 		} while (changed);
 		console->info("================== Hillclimbed for {} rounds.", climb_iteration);
@@ -362,8 +625,131 @@ int main(int argc, char** argv) {
 
 	console->info("Final average cost per vertex: {}", score / vertices.size());
 
-	const string svg_filename = "output.svg";
-	console->info("Writing {} ...", svg_filename);
-	write_svg(vertices, edges, positions_after_preprocessing, positions_first_feasible, positions_after_annealing, svg_filename);
+	if (!settings.report_filename.empty()) {
+		console->info("Writing {} ...", settings.report_filename);
+		ofstream report(settings.report_filename);
+		report << "{\n\t\"feasibility\": ";
+		feasibility_stats.write_json(report);
+		report << ",\n\t\"quality\": ";
+		quality_stats.write_json(report);
+		report << "\n}\n";
+	}
+
+	if (!outputs.svg_filename.empty()) {
+		console->info("Writing {} ...", outputs.svg_filename);
+		write_svg(vertices, edges, positions_after_preprocessing, positions_first_feasible, positions_after_annealing, outputs.svg_filename);
+	}
+	if (!outputs.result_filename.empty()) {
+		console->info("Writing {} ...", outputs.result_filename);
+		outputs_written = write_agffile(outputs.result_filename, vertices, edges) && outputs_written;
+	}
+	if (dump_written.valid()) outputs_written = dump_written.get() && outputs_written;
+	if (!outputs_written) return result;
+
+	result.ok = true;
+	result.cost = score / vertices.size();
+	result.feasibility_iterations = feasibility_stats.iterations;
+	result.quality_iterations = annealing_iteration;
+	result.seconds = run_time.elapsed().count();
+	return result;
+}
+
+// Reads the input filenames of a batch: one per line; blank lines and lines starting with # are skipped.
+vector<string> read_batch_list(const string& filename) {
+	vector<string> inputs;
+	ifstream list(filename);
+	if (!list.is_open()) {
+		console->error("Could not open batch list '{}'", filename);
+		return inputs;
+	}
+	string line;
+	while (getline(list, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+		inputs.push_back(line);
+	}
+	return inputs;
+}
+
+void write_batch_summary(ostream& output, const vector<string>& inputs, const vector<RunResult>& results) {
+	size_t name_width = 5;
+	for (const string& input : inputs) name_width = std::max(name_width, input.length());
+	output << fmt::format("{:<{}}  {:>9}  {:>12}  {:>9}  {:>11}  {:>11}\n", "input", name_width, "vertices", "cost/vertex", "seconds", "feasibility", "quality");
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		const RunResult& r = results[i];
+		if (r.ok) {
+			output << fmt::format("{:<{}}  {:>9}  {:>12.6f}  {:>9.3f}  {:>11}  {:>11}\n", inputs[i], name_width, r.num_vertices, r.cost, r.seconds, r.feasibility_iterations, r.quality_iterations);
+		}
+		else {
+			output << fmt::format("{:<{}}  failed\n", inputs[i], name_width);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	// Parse command line arguments.
+	auto args = docopt::docopt(USAGE, { argv + 1, argv + argc }, true, "Align");
+
+	// Setup logging console and handle verbose flag.
+	console = spdlog::stderr_color_mt("main");
+	if (args["--verbose"].asBool()) console->set_level(spdlog::level::info);
+	else console->set_level(spdlog::level::err);
+
+	Settings settings = parse_settings(args);
 
+	// --output
+	ofstream output_file;
+	bool output_to_file = false;
+	if (args["--output"].isString()) {
+		output_to_file = true;
+		output_file.open(args["--output"].asString());
+	}
+	ostream& output = output_to_file ? output_file : std::cout;
+
+	if (args["--convert"].isString()) {
+		Vertices vertices;
+		Edges edges;
+		bool ok = load_graph(args["<input>"].asString(), vertices, edges, settings.load_threads) &&
+			write_graph(args["--convert"].asString(), vertices, edges);
+		for (Edge* e : edges) delete e;
+		for (Vertex* v : vertices) delete v;
+		return ok ? 0 : -1;
+	}
+
+	if (!args["--batch"].asBool()) {
+		Outputs outputs{ "feasible" + settings.dump_extension, "output.svg", "" };
+		RunResult result = run(args["<input>"].asString(), settings, outputs);
+		return result.ok ? 0 : -1;
+	}
+
+	// === Batch mode: every input gets its own run, on a bounded pool of workers.
+	vector<string> inputs = read_batch_list(args["<list>"].asString());
+	if (!settings.snapshot_filename.empty() || !settings.resume_filename.empty() || !settings.report_filename.empty()) {
+		console->warn("--snapshot, --resume and --report are ignored in batch mode.");
+		settings.snapshot_filename.clear();
+		settings.resume_filename.clear();
+		settings.report_filename.clear();
+	}
+	int num_jobs = std::max(1, static_cast<int>(args["--jobs"].asLong()));
+	num_jobs = std::min<int>(num_jobs, std::max<size_t>(1, inputs.size()));
+	console->info("Batch of {} inputs on {} workers", inputs.size(), num_jobs);
+
+	vector<RunResult> results(inputs.size());
+	atomic<size_t> next_input{ 0 };
+	auto worker = [&]() {
+		for (size_t i = next_input++; i < inputs.size(); i = next_input++) {
+			string stem = inputs[i].substr(0, inputs[i].find_last_of('.'));
+			Outputs outputs{ stem + ".feasible" + settings.dump_extension, "", stem + ".rounded.agf" };
+			results[i] = run(inputs[i], settings, outputs);
+		}
+	};
+	vector<thread> workers;
+	for (int j = 1; j < num_jobs; ++j) workers.emplace_back(worker);
+	worker();
+	for (thread& t : workers) t.join();
+
+	write_batch_summary(output, inputs, results);
+	bool all_ok = std::all_of(results.begin(), results.end(), [](const RunResult& r) { return r.ok; });
+	return all_ok ? 0 : -1;
 }
+
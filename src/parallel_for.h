@@ -0,0 +1,33 @@
+#ifndef INCLUDED_PARALLEL_FOR
+#define INCLUDED_PARALLEL_FOR
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Calls f(i) for every i in [begin, end), in contiguous blocks on the hardware threads.
+// Small ranges run on the calling thread. f must only write to data owned by its own i.
+template<typename F>
+void parallel_for(size_t begin, size_t end, F f) {
+	if (end <= begin) return;
+	const size_t min_block = 4096;
+	size_t n = end - begin;
+	size_t num_threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+	num_threads = std::min(num_threads, (n + min_block - 1) / min_block);
+	if (num_threads <= 1) {
+		for (size_t i = begin; i < end; ++i) f(i);
+		return;
+	}
+	size_t block = (n + num_threads - 1) / num_threads;
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < num_threads; ++t) {
+		size_t first = begin + t * block;
+		size_t last = std::min(end, first + block);
+		threads.emplace_back([first, last, &f]() {
+			for (size_t i = first; i < last; ++i) f(i);
+		});
+	}
+	for (std::thread& thread : threads) thread.join();
+}
+
+#endif //ndef INCLUDED_PARALLEL_FOR
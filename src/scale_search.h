@@ -0,0 +1,125 @@
+#ifndef INCLUDED_SCALE_SEARCH
+#define INCLUDED_SCALE_SEARCH
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Logging.h"
+#include "Vertex.h"
+
+// Positions and rounding flags of a drawing, to go back to the drawing a successful trial left.
+// Vertices are matched by their index in the vector.
+struct DrawingState {
+	std::vector<Vertex::Point> positions;
+	std::vector<char> rounded;
+
+	void save(const std::vector<Vertex*>& vertices) {
+		positions.resize(vertices.size());
+		rounded.resize(vertices.size());
+		for (size_t i = 0; i < vertices.size(); ++i) {
+			positions[i] = vertices[i]->current;
+			rounded[i] = vertices[i]->is_rounded;
+		}
+	}
+	void restore(const std::vector<Vertex*>& vertices) const {
+		for (size_t i = 0; i < vertices.size(); ++i) {
+			vertices[i]->current = positions[i];
+			vertices[i]->is_rounded = rounded[i];
+		}
+	}
+};
+
+// Finds a small factor k * resolution (k = 1, 2, ...) for which feasible(factor) returns true;
+// feasible applies the factor to the drawing of the given vertices. The drawing a successful trial
+// leaves is saved, and the drawing of the returned factor is restored at the end.
+// Doubles k until a feasible factor is found, then bisects between the last infeasible and the
+// first feasible one. Feasibility is not strictly monotone in the factor (rounding can line up
+// better at a smaller scale), so the bisection can skip feasible factors; a final linear pass over
+// the few factors just below the result catches the nearby ones.
+template<typename Feasible>
+double search_scale_factor(Feasible feasible, const std::vector<Vertex*>& vertices, double resolution, const std::string& name) {
+	const long long refinement_window = 4;
+	std::map<long long, bool> tried;
+	long long last_applied = 0;
+	DrawingState best_drawing;
+	auto test = [&](long long k) {
+		auto it = tried.find(k);
+		if (it != tried.end()) return it->second;
+		console->info("{} trying factor {}...", name, k * resolution);
+		bool ok = feasible(k * resolution);
+		tried[k] = ok;
+		last_applied = k;
+		// every later success is at a smaller factor
+		if (ok) best_drawing.save(vertices);
+		return ok;
+	};
+
+	// exponential phase
+	long long low = 0; // 0 stands for "no infeasible factor found yet"
+	long long high = 1;
+	while (!test(high)) {
+		low = high;
+		high *= 2;
+	}
+	// binary phase: low infeasible (or 0), high feasible
+	while (high - low > 1) {
+		long long middle = low + (high - low) / 2;
+		if (test(middle)) high = middle;
+		else low = middle;
+	}
+	// linear refinement below the result
+	for (long long k = std::max(1LL, high - refinement_window); k < high; ++k) {
+		if (test(k)) {
+			high = k;
+			break;
+		}
+	}
+	if (last_applied != high) best_drawing.restore(vertices);
+	console->info("{} used factor {} after {} trials.", name, high * resolution, tried.size());
+	return high * resolution;
+}
+
+// Tries the factors k * resolution (k = 1, 2, ...) in ascending order on num_threads threads and
+// returns the smallest feasible one, the same factor a sequential scan finds. probe(factor, cancelled, drawing)
+// must work on its own copy of the drawing and, when it succeeds, save that copy in drawing;
+// cancelled() turns true once a smaller factor succeeded, and probe may then give up early.
+// The drawing of the returned factor is put into the given vertices.
+template<typename Probe>
+double probe_scale_factors(Probe probe, const std::vector<Vertex*>& vertices, double resolution, int num_threads, const std::string& name) {
+	std::atomic<long long> next{ 1 };
+	std::atomic<long long> best{ LLONG_MAX };
+	std::mutex best_mutex;
+	long long best_saved = LLONG_MAX;
+	DrawingState best_drawing;
+	auto worker = [&]() {
+		while (true) {
+			long long k = next++;
+			if (k > best) return;
+			auto cancelled = [&]() { return best < k; };
+			console->info("{} trying factor {}...", name, k * resolution);
+			DrawingState drawing;
+			if (probe(k * resolution, cancelled, drawing)) {
+				long long current = best;
+				while (k < current && !best.compare_exchange_weak(current, k)) {}
+				std::lock_guard<std::mutex> lock(best_mutex);
+				if (k < best_saved) {
+					best_saved = k;
+					best_drawing = std::move(drawing);
+				}
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_threads; ++i) threads.emplace_back(worker);
+	for (std::thread& t : threads) t.join();
+	best_drawing.restore(vertices);
+	console->info("{} found factor {} on {} threads.", name, best * resolution, num_threads);
+	return best * resolution;
+}
+
+#endif //ndef INCLUDED_SCALE_SEARCH
@@ -0,0 +1,196 @@
+#include "snap_rounding.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+using std::unordered_map;
+using std::vector;
+
+#include "Vertex.h"
+#include "Edge.h"
+#include "BinnedGeometry.h"
+#include "Timer.h"
+
+#include "Logging.h"
+
+Edge* make_edge(Vertex* p, Vertex* q);
+
+namespace {
+
+// Calls f(x, y) for every cell (closed unit square around a grid point) that the segment from p
+// to q meets, one column at a time.
+template<typename F>
+void walk_cells(const Vertex::Point& p, const Vertex::Point& q, F f) {
+	long long x0 = std::llround(p.x);
+	long long x1 = std::llround(q.x);
+	long long step_x = x1 >= x0 ? 1 : -1;
+	for (long long x = x0; ; x += step_x) {
+		double y_in = p.y, y_out = q.y;
+		if (q.x != p.x) {
+			double slope = (q.y - p.y) / (q.x - p.x);
+			double x_in = step_x > 0 ? std::max(p.x, x - 0.5) : std::min(p.x, x + 0.5);
+			double x_out = step_x > 0 ? std::min(q.x, x + 0.5) : std::max(q.x, x - 0.5);
+			y_in = p.y + slope * (x_in - p.x);
+			y_out = p.y + slope * (x_out - p.x);
+		}
+		long long y0 = std::llround(std::min(y_in, y_out));
+		long long y1 = std::llround(std::max(y_in, y_out));
+		for (long long y = y0; y <= y1; ++y) f(x, y);
+		if (x == x1) break;
+	}
+}
+
+// Where the segment from p to q enters the closed pixel around c, as a fraction of its length; -1 if it misses.
+double enter_pixel(const Vertex::Point& p, const Vertex::Point& q, const Vertex::Point& c) {
+	double t0 = 0, t1 = 1;
+	const double d[2] = { q.x - p.x, q.y - p.y };
+	const double low[2] = { c.x - 0.5 - p.x, c.y - 0.5 - p.y };
+	const double high[2] = { c.x + 0.5 - p.x, c.y + 0.5 - p.y };
+	for (int k = 0; k < 2; ++k) {
+		if (d[k] == 0) {
+			if (low[k] > 0 || high[k] < 0) return -1;
+			continue;
+		}
+		double a = low[k] / d[k], b = high[k] / d[k];
+		if (a > b) std::swap(a, b);
+		t0 = std::max(t0, a);
+		t1 = std::min(t1, b);
+		if (t0 > t1) return -1;
+	}
+	return t0;
+}
+
+// The hot pixels, also bucketed in square blocks of pixels, so that a segment only visits the blocks
+// it passes instead of every pixel. The block size is odd, so every pixel lies in a single block.
+class HotPixels {
+public:
+	// Index of the hot pixel around grid point (x, y), made hot if it was not yet.
+	int add(long long x, long long y) {
+		auto [pixel, is_new] = pixels.emplace(key(x, y), static_cast<int>(centres.size()));
+		if (is_new) {
+			centres.push_back({ static_cast<double>(x), static_cast<double>(y) });
+			blocks[key(block_of(x), block_of(y))].push_back(pixel->second);
+		}
+		return pixel->second;
+	}
+	const Vertex::Point& centre(int pixel) const { return centres[pixel]; }
+	size_t size() const { return centres.size(); }
+
+	// The hot pixels that the segment from p to q meets, ordered from p to q.
+	void collect(const Vertex::Point& p, const Vertex::Point& q, vector<int>& result) const {
+		hits.clear();
+		Vertex::Point block_p{ p.x / block_size, p.y / block_size };
+		Vertex::Point block_q{ q.x / block_size, q.y / block_size };
+		walk_cells(block_p, block_q, [&](long long bx, long long by) {
+			auto block = blocks.find(key(bx, by));
+			if (block == blocks.end()) return;
+			for (int pixel : block->second) {
+				double t = enter_pixel(p, q, centres[pixel]);
+				if (t >= 0) hits.push_back({ t, pixel });
+			}
+		});
+		std::sort(hits.begin(), hits.end());
+		result.clear();
+		for (auto [t, pixel] : hits) result.push_back(pixel);
+	}
+
+private:
+	static constexpr long long block_size = 15;
+	unordered_map<uint64_t, int> pixels;
+	unordered_map<uint64_t, vector<int>> blocks;
+	vector<Vertex::Point> centres;
+	mutable vector<std::pair<double, int>> hits;
+
+	static uint64_t key(long long x, long long y) {
+		return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+	}
+	static long long block_of(long long x) {
+		return std::llround(static_cast<double>(x) / block_size);
+	}
+};
+
+}
+
+SnapMapping snap_round(vector<Vertex*>& vertices, vector<Edge*>& edges) {
+	console->info("Running snap rounding...");
+	Timer snap_time;
+	SnapMapping mapping;
+
+	// hot pixels: the first vertex in a pixel represents it, later ones are merged into it
+	HotPixels hot_pixels;
+	mapping.snapped_vertex.resize(vertices.size());
+	for (Vertex* v : vertices) {
+		int pixel = hot_pixels.add(std::llround(v->current.x), std::llround(v->current.y));
+		if (pixel == static_cast<int>(mapping.input_vertex.size())) mapping.input_vertex.push_back(v->id);
+		mapping.snapped_vertex[v->id] = pixel;
+	}
+
+	// route every edge through the hot pixels it passes, then iterate on the pieces of the route
+	int num_rerouted = 0;
+	vector<int> passed;
+	mapping.edge_path.reserve(edges.size());
+	for (Edge* e : edges) {
+		int first = mapping.snapped_vertex[e->a->id];
+		int last = mapping.snapped_vertex[e->b->id];
+		vector<int> route{ first };
+		hot_pixels.collect(e->a->current, e->b->current, passed);
+		for (int pixel : passed) {
+			if (pixel != first && pixel != last) route.push_back(pixel);
+		}
+		if (last != first) route.push_back(last);
+		bool changed = route.size() > 1;
+		while (changed) {
+			changed = false;
+			vector<int> next{ route.front() };
+			for (size_t i = 1; i < route.size(); ++i) {
+				hot_pixels.collect(hot_pixels.centre(route[i - 1]), hot_pixels.centre(route[i]), passed);
+				for (int pixel : passed) {
+					// a route visits a pixel at most once, or it would fold back on itself
+					if (std::find(route.begin(), route.end(), pixel) == route.end() && std::find(next.begin(), next.end(), pixel) == next.end()) {
+						next.push_back(pixel);
+						changed = true;
+					}
+				}
+				next.push_back(route[i]);
+			}
+			route.swap(next);
+		}
+		if (route.size() > 2) ++num_rerouted;
+		mapping.edge_path.push_back(std::move(route));
+	}
+
+	// build the snapped graph, reusing the Vertex of the first input vertex in every hot pixel
+	vector<Vertex*> snapped(hot_pixels.size());
+	for (Vertex* v : vertices) {
+		int s = mapping.snapped_vertex[v->id];
+		if (mapping.input_vertex[s] != v->id) {
+			delete v;
+			continue;
+		}
+		v->current = hot_pixels.centre(s);
+		v->set_rounded_state();
+		v->id = s;
+		v->N.clear();
+		snapped[s] = v;
+	}
+	for (Edge* e : edges) delete e;
+	edges.clear();
+	for (const vector<int>& route : mapping.edge_path) {
+		for (size_t i = 1; i < route.size(); ++i) {
+			Edge* e = make_edge(snapped[route[i - 1]], snapped[route[i]]);
+			if (e != nullptr) edges.push_back(e);
+		}
+	}
+	vertices.swap(snapped);
+	for (Vertex* v : vertices) v->set_rotsys();
+
+	console->info("Snap rounding merged {} vertices and rerouted {} edges; {} vertices and {} edges remain.",
+		mapping.snapped_vertex.size() - vertices.size(), num_rerouted, vertices.size(), edges.size());
+	console->info("Snap rounding took {:.3f} seconds.", snap_time.elapsed().count());
+	BinnedGeometry geom_checker;
+	if (!geom_checker.collect_violations(vertices, edges).empty()) {
+		console->error("Snap-rounded drawing is not valid. Things are going to be bad.");
+	}
+	return mapping;
+}
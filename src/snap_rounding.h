@@ -0,0 +1,22 @@
+#ifndef INCLUDED_SNAP_ROUNDING
+#define INCLUDED_SNAP_ROUNDING
+
+#include <vector>
+class Vertex;
+class Edge;
+
+// How the snapped graph relates to the input graph; ids are those before and after snapping.
+struct SnapMapping {
+	std::vector<int> snapped_vertex; // per input vertex: the snapped vertex it was merged into
+	std::vector<int> input_vertex; // per snapped vertex: the input vertex whose Vertex it continues
+	std::vector<std::vector<int>> edge_path; // per input edge: the snapped vertices it runs through, from a to b
+};
+
+// Iterated snap rounding on the unit grid. Every pixel (unit square around a grid point) that contains
+// a vertex is hot; its vertices are merged into one vertex at its centre. Every edge is routed through
+// the hot pixels it passes, and each piece of the route is rerouted through the hot pixels it passes
+// in turn, until no piece passes a hot pixel it is not routed through. The input must be a plane drawing.
+// Replaces vertices and edges by the snapped graph and returns how it maps to the input.
+SnapMapping snap_round(std::vector<Vertex*>& vertices, std::vector<Edge*>& edges);
+
+#endif //ndef INCLUDED_SNAP_ROUNDING
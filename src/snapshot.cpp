@@ -0,0 +1,151 @@
+#include "snapshot.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+
+using std::string;
+using std::vector;
+
+#include "Logging.h"
+
+// File layout: magic, then the fixed-size header, then the rng state, the coordinates,
+// the positions carried from earlier in the run and the stats of both phases.
+static const char snapshot_magic[8] = { 'A', 'R', 'M', 'S', 'N', 'A', 'P', '2' };
+
+template<typename T>
+static void write_raw(ofstream& out, const T& x) {
+	out.write(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+template<typename T>
+static bool read_raw(ifstream& in, T& x) {
+	return static_cast<bool>(in.read(reinterpret_cast<char*>(&x), sizeof(T)));
+}
+
+// Bytes left after the read position; counts read from the file are checked against it before allocating.
+static uint64_t remaining_size(ifstream& in) {
+	std::streampos here = in.tellg();
+	in.seekg(0, std::ios::end);
+	std::streampos end = in.tellg();
+	in.seekg(here);
+	return here < 0 || end < here ? 0 : static_cast<uint64_t>(end - here);
+}
+
+static void write_points(ofstream& out, const vector<Vertex::Point>& points) {
+	write_raw(out, static_cast<uint64_t>(points.size()));
+	for (const Vertex::Point& p : points) write_raw(out, p);
+}
+static bool read_points(ifstream& in, vector<Vertex::Point>& points, uint64_t max_size) {
+	uint64_t size;
+	if (!read_raw(in, size) || size > max_size || size > remaining_size(in) / sizeof(Vertex::Point)) return false;
+	points.resize(size);
+	for (Vertex::Point& p : points) {
+		if (!read_raw(in, p)) return false;
+	}
+	return true;
+}
+
+bool write_snapshot(const string& filename, const AnnealingSnapshot& snapshot) {
+	// write next to the target and rename, so a kill during writing keeps the previous snapshot
+	string temp_filename = filename + ".tmp";
+	{
+		ofstream out(temp_filename, std::ios::binary);
+		if (!out.is_open()) {
+			console->error("Could not open '{}' for writing snapshot", temp_filename);
+			return false;
+		}
+		out.write(snapshot_magic, sizeof(snapshot_magic));
+		write_raw(out, static_cast<int32_t>(snapshot.phase));
+		write_raw(out, static_cast<int32_t>(snapshot.method));
+		write_raw(out, static_cast<int32_t>(snapshot.iteration));
+		write_raw(out, snapshot.temperature);
+		write_raw(out, snapshot.cooling);
+		write_raw(out, snapshot.score);
+		write_raw(out, static_cast<int32_t>(snapshot.num_edges));
+		write_raw(out, static_cast<uint64_t>(snapshot.current.size()));
+		write_raw(out, static_cast<uint64_t>(snapshot.rng_state.size()));
+		out.write(snapshot.rng_state.data(), snapshot.rng_state.size());
+		for (size_t i = 0; i < snapshot.current.size(); ++i) {
+			write_raw(out, snapshot.original[i]);
+			write_raw(out, snapshot.current[i]);
+		}
+		write_points(out, snapshot.preprocessed);
+		write_points(out, snapshot.first_feasible);
+		snapshot.feasibility_stats.write_binary(out);
+		snapshot.quality_stats.write_binary(out);
+		if (!out) {
+			console->error("Failed writing snapshot '{}'", temp_filename);
+			return false;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(temp_filename, filename, error);
+	if (error) {
+		console->error("Could not move snapshot to '{}': {}", filename, error.message());
+		return false;
+	}
+	console->info("Wrote snapshot at iteration {} to '{}'", snapshot.iteration, filename);
+	return true;
+}
+
+bool read_snapshot(const string& filename, AnnealingSnapshot& snapshot) {
+	ifstream in(filename, std::ios::binary);
+	if (!in.is_open()) {
+		console->error("Could not open snapshot '{}'", filename);
+		return false;
+	}
+	char magic[sizeof(snapshot_magic)];
+	if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, snapshot_magic, sizeof(magic)) != 0) {
+		console->error("'{}' is not a snapshot file", filename);
+		return false;
+	}
+	int32_t phase, method, iteration, num_edges;
+	uint64_t num_vertices, rng_length;
+	bool ok = read_raw(in, phase) && read_raw(in, method) && read_raw(in, iteration)
+		&& read_raw(in, snapshot.temperature) && read_raw(in, snapshot.cooling) && read_raw(in, snapshot.score)
+		&& read_raw(in, num_edges) && read_raw(in, num_vertices) && read_raw(in, rng_length)
+		&& rng_length <= remaining_size(in) && num_vertices <= (remaining_size(in) - rng_length) / (2 * sizeof(Vertex::Point));
+	if (ok) {
+		snapshot.phase = phase;
+		snapshot.method = method;
+		snapshot.iteration = iteration;
+		snapshot.num_edges = num_edges;
+		snapshot.rng_state.resize(rng_length);
+		ok = static_cast<bool>(in.read(snapshot.rng_state.data(), rng_length));
+	}
+	if (ok) {
+		snapshot.original.resize(num_vertices);
+		snapshot.current.resize(num_vertices);
+		for (uint64_t i = 0; ok && i < num_vertices; ++i) {
+			ok = read_raw(in, snapshot.original[i]) && read_raw(in, snapshot.current[i]);
+		}
+	}
+	ok = ok && read_points(in, snapshot.preprocessed, num_vertices) && read_points(in, snapshot.first_feasible, num_vertices)
+		&& snapshot.feasibility_stats.read_binary(in) && snapshot.quality_stats.read_binary(in);
+	if (!ok) {
+		console->error("Snapshot '{}' is truncated", filename);
+		return false;
+	}
+	return true;
+}
+
+bool AnnealingSnapshot::restore_positions(const vector<Vertex*>& vertices, int expected_edges) const {
+	if (current.size() != vertices.size() || num_edges != expected_edges) {
+		console->error("Snapshot has {} vertices and {} edges, but input has {} and {}", current.size(), num_edges, vertices.size(), expected_edges);
+		return false;
+	}
+	if (preprocessed.size() != current.size() || (phase == quality && first_feasible.size() != current.size())) {
+		console->error("Snapshot lacks the positions from earlier in the run");
+		return false;
+	}
+	for (Vertex* v : vertices) {
+		v->original = original[v->id];
+		v->current = current[v->id];
+		v->set_rounded_state();
+	}
+	return true;
+}
@@ -0,0 +1,89 @@
+#ifndef INCLUDED_SNAPSHOT
+#define INCLUDED_SNAPSHOT
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include "Vertex.h"
+#include "Timer.h"
+#include "AnnealingStats.h"
+
+// State of an annealing run, enough to continue it after the process is killed. The caches derived
+// from the positions (densities, sampling weights, which vertices to retry) are rebuilt on resume
+// instead of saved, so the continuation is close to but not exactly the uninterrupted run:
+// recomputed densities can differ from incrementally updated ones in the last bits, and barneshut
+// densities by more, since they are refreshed on a schedule.
+struct AnnealingSnapshot {
+	enum Phase { feasibility = 0, quality = 1 };
+	int phase = feasibility;
+	int method = 0; // the feasibility method of the run
+	int iteration = 0;
+	double temperature = 0;
+	double cooling = 0;
+	double score = 0;
+	std::string rng_state;
+	int num_edges = 0;
+	std::vector<Vertex::Point> original;
+	std::vector<Vertex::Point> current;
+	// results from earlier in the run; first_feasible is empty during the feasibility phase
+	std::vector<Vertex::Point> preprocessed;
+	std::vector<Vertex::Point> first_feasible;
+	AnnealingStats feasibility_stats{ "feasibility" };
+	AnnealingStats quality_stats{ "quality" };
+
+	template<typename RNG>
+	void restore_rng(RNG& rng) const {
+		std::istringstream in(rng_state);
+		in >> rng;
+	}
+	// Puts the snapshot positions into the vertices; false if the graph does not match.
+	bool restore_positions(const std::vector<Vertex*>& vertices, int expected_edges) const;
+};
+
+bool write_snapshot(const std::string& filename, const AnnealingSnapshot& snapshot);
+bool read_snapshot(const std::string& filename, AnnealingSnapshot& snapshot);
+
+// Periodically writes snapshots of an annealing run; does nothing if filename is empty.
+class SnapshotWriter {
+public:
+	SnapshotWriter(const std::string& filename, double interval_seconds) : filename(filename), interval(interval_seconds) {}
+
+	bool due() const {
+		return !filename.empty() && last_write.elapsed().count() >= interval;
+	}
+
+	// Method, positions and stats from earlier in the run, which the caller fills in as they become known.
+	AnnealingSnapshot carried;
+
+	template<typename RNG>
+	void write(AnnealingSnapshot::Phase phase, int iteration, double temperature, double cooling, double score,
+		const RNG& rng, const std::vector<Vertex*>& vertices, int num_edges, const AnnealingStats& stats) {
+		AnnealingSnapshot snapshot = carried;
+		snapshot.phase = phase;
+		snapshot.iteration = iteration;
+		snapshot.temperature = temperature;
+		snapshot.cooling = cooling;
+		snapshot.score = score;
+		std::ostringstream rng_out;
+		rng_out << rng;
+		snapshot.rng_state = rng_out.str();
+		snapshot.num_edges = num_edges;
+		(phase == AnnealingSnapshot::feasibility ? snapshot.feasibility_stats : snapshot.quality_stats) = stats;
+		snapshot.original.reserve(vertices.size());
+		snapshot.current.reserve(vertices.size());
+		for (Vertex* v : vertices) {
+			snapshot.original.push_back(v->original);
+			snapshot.current.push_back(v->current);
+		}
+		write_snapshot(filename, snapshot);
+		last_write = Timer();
+	}
+
+private:
+	std::string filename;
+	double interval;
+	Timer last_write;
+};
+
+#endif //ndef INCLUDED_SNAPSHOT